@@ -0,0 +1,60 @@
+/*
+ * Included ahead of everything in the loader sources for the
+ * hosted build.
+ *
+ * The loader brings its own C library bits. These are renamed so
+ * they don't interpose on the host C library's, which would have
+ * stdio calling the loader malloc before malloc_init.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef QUIK_HOST_H
+#define QUIK_HOST_H
+
+/* malloc.c */
+#define malloc quik_malloc
+#define free quik_free
+#define realloc quik_realloc
+#define malloc_stats quik_malloc_stats
+
+/* util.c */
+#define strdup quik_strdup
+#define strstr quik_strstr
+#define strcasecmp quik_strcasecmp
+#define strtol quik_strtol
+#define tolower quik_tolower
+
+/* prom.c */
+#define putchar quik_putchar
+#define getchar quik_getchar
+
+/* string.S, see libc.c */
+#define strcpy quik_strcpy
+#define strncpy quik_strncpy
+#define strcat quik_strcat
+#define strcmp quik_strcmp
+#define strncmp quik_strncmp
+#define strlen quik_strlen
+#define strchr quik_strchr
+#define strrchr quik_strrchr
+#define memset quik_memset
+#define memcpy quik_memcpy
+#define memmove quik_memmove
+#define memcmp quik_memcmp
+
+#endif /* QUIK_HOST_H */
@@ -0,0 +1,116 @@
+/*
+ * Stand-ins for the loader's assembly routines (string.S, cache.S)
+ * in the hosted build, on top of the host C library.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Lengths are length_t (32 bits) in the loader prototypes.
+ */
+
+char *
+quik_strcpy(char *dest, const char *src)
+{
+   return strcpy(dest, src);
+}
+
+
+char *
+quik_strncpy(char *dest, const char *src, uint32_t n)
+{
+   return strncpy(dest, src, n);
+}
+
+
+char *
+quik_strcat(char *dest, const char *src)
+{
+   return strcat(dest, src);
+}
+
+
+int
+quik_strcmp(const char *s1, const char *s2)
+{
+   return strcmp(s1, s2);
+}
+
+
+int
+quik_strncmp(const char *s1, const char *s2, uint32_t n)
+{
+   return strncmp(s1, s2, n);
+}
+
+
+uint32_t
+quik_strlen(const char *s)
+{
+   return strlen(s);
+}
+
+
+char *
+quik_strchr(const char *s, int c)
+{
+   return strchr(s, c);
+}
+
+
+char *
+quik_strrchr(const char *s, int c)
+{
+   return strrchr(s, c);
+}
+
+
+void *
+quik_memset(void *s, int c, uint32_t n)
+{
+   return memset(s, c, n);
+}
+
+
+void *
+quik_memcpy(void *dest, const void *src, uint32_t n)
+{
+   return memcpy(dest, src, n);
+}
+
+
+void *
+quik_memmove(void *dest, const void *src, uint32_t n)
+{
+   return memmove(dest, src, n);
+}
+
+
+int
+quik_memcmp(const void *s1, const void *s2, uint32_t n)
+{
+   return memcmp(s1, s2, n);
+}
+
+
+void
+flush_cache(uintptr_t base, uint32_t len)
+{
+}
@@ -0,0 +1,212 @@
+/*
+ * Hosted build driver.
+ *
+ * Runs the loader core against the OF emulator in ofemu.c. Every
+ * argument after the emulator options is a loader command, run as
+ * if typed at the boot prompt, e.g.
+ *
+ *   iquik-host -m scsi -d hd=disk.img -a hd:2 '!load /vmlinux' '!iostat'
+ *
+ * !load and !conf exist only here, for loading a kernel (and
+ * an initrd) and parsing a configuration file the way the boot
+ * path does.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "quik.h"
+#include "prom.h"
+#include "file.h"
+#include "image.h"
+#include "timing.h"
+#include "commands.h"
+#include "ofemu.h"
+#include <layout.h>
+
+boot_info_t *bi = &(boot_info_t) { 0 };
+
+/*
+ * Normally from ld.script. Nothing follows the hosted build.
+ */
+uint32_t _preboot_script;
+
+
+static quik_err_t
+host_cmd_load(char *args)
+{
+   quik_err_t err;
+   path_t *path;
+   path_t *initrd_path = NULL;
+   char *initrd;
+   char *rest;
+   vaddr_t buf = LOAD_BASE;
+   vaddr_t initrd_buf;
+   length_t len;
+   length_t initrd_len;
+   load_state_t image;
+
+   word_split(&args, &initrd);
+   if (args == NULL) {
+      return ERR_CMD_BAD_PARAM;
+   }
+
+   err = file_path(args, &bi->default_dev, &path);
+   if (err != ERR_NONE) {
+      return err;
+   }
+
+   if (*initrd != '\0') {
+      word_split(&initrd, &rest);
+      err = file_path(initrd, &bi->default_dev, &initrd_path);
+      if (err != ERR_NONE) {
+         file_path_free(path);
+         return err;
+      }
+   }
+
+   timing_mark("kernel");
+   image_begin();
+   err = image_load(path, &buf, &len);
+   if (err == ERR_NONE) {
+      err = elf_parse((void *) buf, len, &image);
+   }
+
+   if (err == ERR_NONE) {
+      timing_mark("elf_relo");
+      err = elf_relo(&image);
+   }
+
+   if (err == ERR_NONE) {
+      printk("Kernel: 0x%x @ 0x%x, entry 0x%x\n", image.text_len,
+             image.linked_base, image.entry);
+   }
+
+   if (err == ERR_NONE && initrd_path != NULL) {
+      timing_mark("initrd");
+      initrd_buf = buf + len;
+      err = image_load(initrd_path, &initrd_buf, &initrd_len);
+      if (err == ERR_NONE) {
+         printk("Initrd: 0x%x @ 0x%x\n", initrd_len, initrd_buf);
+      }
+   }
+
+   timing_mark(NULL);
+   file_path_free(initrd_path);
+   file_path_free(path);
+   return err;
+}
+
+COMMAND(load, host_cmd_load, "load and parse a kernel, then load an initrd if one is given");
+
+
+static quik_err_t
+host_cmd_conf(char *args)
+{
+   quik_err_t err;
+   path_t *path;
+   length_t len;
+   char *buf;
+
+   if (*args == '\0') {
+      return ERR_CMD_BAD_PARAM;
+   }
+
+   err = file_path(args, &bi->default_dev, &path);
+   if (err != ERR_NONE) {
+      return err;
+   }
+
+   timing_mark("load_config");
+   err = file_len(path, &len);
+   if (err != ERR_NONE) {
+      goto out;
+   }
+
+   /*
+    * Parsed values point into buf, so it is kept.
+    */
+   buf = malloc(len + 1);
+   if (buf == NULL) {
+      err = ERR_NO_MEM;
+      goto out;
+   }
+
+   err = file_load(path, buf);
+   if (err != ERR_NONE) {
+      free(buf);
+      goto out;
+   }
+
+   if (cfg_parse(path->path, buf, len) < 0) {
+      printk_err("Syntax error or read error in '%P'\n", path);
+   }
+
+   cfg_print_images();
+   if (cfg_get_default() != NULL) {
+      printk("Default: %s\n", cfg_get_default());
+   }
+
+out:
+   timing_mark(NULL);
+   file_path_free(path);
+   return err;
+}
+
+COMMAND(conf, host_cmd_conf, "parse a configuration file given a [device:part]/fs/path");
+
+
+int
+main(int argc,
+     char **argv)
+{
+   int i;
+   uint32_t start;
+   quik_err_t err;
+
+   i = ofemu_configure(argc, argv);
+   start = ofemu_wall_us();
+
+   err = prom_init(ofemu_entry);
+   if (err == ERR_NONE) {
+      err = malloc_init();
+   }
+
+   if (err == ERR_NONE) {
+      err = cmd_init();
+   }
+
+   if (err == ERR_NONE) {
+      timing_mark("env_init");
+      err = env_init();
+      timing_mark(NULL);
+   }
+
+   if (err != ERR_NONE) {
+      printk("%r\n", err);
+      prom_flush();
+      return 1;
+   }
+
+   for (; i < argc; i++) {
+      printk("boot: %s\n", argv[i]);
+      cmd_dispatch(argv[i]);
+   }
+
+   prom_flush();
+   ofemu_report(ofemu_wall_us() - start);
+   return 0;
+}
@@ -0,0 +1,965 @@
+/*
+ * OF client interface emulator for the hosted build.
+ *
+ * Implements the client interface services the loader uses on
+ * top of disk image files and a device tree made up from defaults
+ * and an optional tree file. RAM is a host mapping at the same
+ * addresses the loader claims on a Mac, so loader pointers work
+ * unchanged.
+ *
+ * Time is virtual. Every call costs the firmware profile's call
+ * latency, and disk reads add seek and transfer time from the
+ * media profile. host_mftb() reads the virtual clock as a 1MHz
+ * timebase, so the loader's own !timing, !promstat and !iostat
+ * report modelled time, and runs are repeatable.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ofemu.h"
+
+/*
+ * RAM below this is firmware's, as are the top FW_SIZE bytes.
+ */
+#define RAM_BASE 0x100000
+#define FW_SIZE  0x400000
+#define RAM_DEFAULT_MB 64
+#define RAM_MAX_MB 1024
+
+#define MAX_CLAIMS 256
+#define MAX_ARGS 10
+
+/* Same layout as struct prom_args in loader/prom.h. */
+typedef struct {
+   char *service;
+   int nargs;
+   int nret;
+   void *args[MAX_ARGS];
+} of_args_t;
+
+typedef struct prop {
+   char *name;
+   void *value;
+   int len;
+   struct prop *next;
+} prop_t;
+
+typedef struct node {
+   char *name;
+   struct node *parent;
+   struct node *child;
+   struct node *peer;
+   prop_t *props;
+
+   /* For disks. */
+   int fd;
+   uint64_t size;
+} node_t;
+
+typedef enum {
+   INST_OTHER,
+   INST_CONSOLE,
+   INST_DISK,
+} inst_kind_t;
+
+typedef struct {
+   node_t *node;
+   inst_kind_t kind;
+   uint64_t pos;
+   uint64_t next;
+} inst_t;
+
+typedef struct {
+   char *name;
+   char *version;
+   char *model;
+   unsigned call_us;
+} firmware_t;
+
+typedef struct {
+   char *name;
+   unsigned seek_us;
+   unsigned kbps;
+   uint32_t max_transfer;
+} media_t;
+
+/*
+ * Call latencies are rough figures for what a Forth client
+ * interface costs on a 100-200MHz 603/604.
+ */
+static firmware_t firmwares[] = {
+   { "2.0.1", "Open Firmware, 2.0.1", "AAPL,3400/2400", 40 },
+   { "2.0", "Open Firmware, 2.0", "AAPL,8500", 40 },
+   { "3", "OpenFirmware 3", "PowerMac2,1", 15 },
+};
+
+static media_t medias[] = {
+   { "ideal", 0, 0, 0x100000 },
+   { "scsi", 10000, 4000, 0x10000 },
+   { "ata", 9000, 6000, 0x20000 },
+   { "cdrom", 110000, 600, 0x10000 },
+   { "floppy", 90000, 45, 0x4800 },
+};
+
+static firmware_t *firmware = &firmwares[0];
+static media_t *media = &medias[0];
+static unsigned call_us;
+static uint32_t ram_top;
+static int verbose;
+
+static node_t *root;
+static node_t *chosen;
+static node_t *options;
+static node_t *aliases;
+static inst_t *console;
+
+static struct {
+   uint32_t base;
+   uint32_t len;
+} claims[MAX_CLAIMS];
+static unsigned claim_count;
+
+static uint64_t emu_us;
+
+/*
+ * Typed at the console once modelled time reaches keys_us, see -k.
+ */
+static char *keys;
+static uint64_t keys_us;
+static unsigned emu_calls;
+static unsigned emu_reads;
+static unsigned emu_seeks;
+static uint64_t emu_bytes;
+
+#define CELL(a, i) ((uint32_t) (uintptr_t) (a)->args[(i)])
+#define PTR(a, i) ((a)->args[(i)])
+#define RET(a, i, v) ((a)->args[(a)->nargs + (i)] = (void *) (intptr_t) (int32_t) (v))
+#define RET_PTR(a, i, v) ((a)->args[(a)->nargs + (i)] = (void *) (v))
+
+
+static void *
+xmalloc(size_t len)
+{
+   void *p = calloc(1, len);
+
+   if (p == NULL) {
+      perror("ofemu");
+      exit(1);
+   }
+
+   return p;
+}
+
+
+static prop_t *
+prop_find(node_t *n,
+          const char *name)
+{
+   prop_t *p;
+
+   for (p = n->props; p != NULL; p = p->next) {
+      if (!strcmp(p->name, name)) {
+         return p;
+      }
+   }
+
+   return NULL;
+}
+
+
+static void
+prop_set(node_t *n,
+         const char *name,
+         const void *value,
+         int len)
+{
+   prop_t *p = prop_find(n, name);
+   prop_t **pp;
+
+   if (p == NULL) {
+      p = xmalloc(sizeof(prop_t));
+      p->name = strdup(name);
+
+      /*
+       * Keep creation order for nextprop.
+       */
+      for (pp = &n->props; *pp != NULL; pp = &(*pp)->next);
+      *pp = p;
+   } else {
+      free(p->value);
+   }
+
+   p->value = xmalloc(len + 1);
+   memcpy(p->value, value, len);
+   p->len = len;
+}
+
+
+static void
+prop_set_str(node_t *n,
+             const char *name,
+             const char *s)
+{
+   prop_set(n, name, s, strlen(s) + 1);
+}
+
+
+static void
+prop_set_cell(node_t *n,
+              const char *name,
+              uint32_t v)
+{
+   prop_set(n, name, &v, sizeof(v));
+}
+
+
+static void
+prop_set_ptr(node_t *n,
+             const char *name,
+             void *v)
+{
+   prop_set(n, name, &v, sizeof(v));
+}
+
+
+/*
+ * A path component matches a node name, or the part before
+ * the unit address if the component has none.
+ */
+static int
+name_match(const char *name,
+           const char *comp,
+           size_t len)
+{
+   const char *at;
+
+   if (strlen(name) == len && !strncmp(name, comp, len)) {
+      return 1;
+   }
+
+   at = strchr(name, '@');
+   return memchr(comp, '@', len) == NULL && at != NULL &&
+      (size_t) (at - name) == len && !strncmp(name, comp, len);
+}
+
+
+/*
+ * Resolve a device path, with aliases and without any
+ * ":args". With create, missing nodes are added.
+ */
+static node_t *
+node_find(const char *path,
+          int create)
+{
+   char buf[512];
+   const char *p;
+   const char *end;
+   size_t len;
+   node_t *n;
+   node_t *c;
+   node_t **cp;
+   prop_t *alias;
+
+   if (path[0] != '/') {
+      len = strcspn(path, "/:");
+      for (alias = aliases->props; alias != NULL; alias = alias->next) {
+         if (strlen(alias->name) == len &&
+             !strncmp(alias->name, path, len)) {
+            break;
+         }
+      }
+
+      if (alias == NULL) {
+         return NULL;
+      }
+
+      snprintf(buf, sizeof(buf), "%s%s", (char *) alias->value, path + len);
+      path = buf;
+   }
+
+   n = root;
+   for (p = path; *p != '\0' && *p != ':'; p = end) {
+      while (*p == '/') {
+         p++;
+      }
+
+      end = p + strcspn(p, "/:");
+      len = end - p;
+      if (len == 0) {
+         break;
+      }
+
+      for (c = n->child; c != NULL; c = c->peer) {
+         if (name_match(c->name, p, len)) {
+            break;
+         }
+      }
+
+      if (c == NULL) {
+         if (!create) {
+            return NULL;
+         }
+
+         c = xmalloc(sizeof(node_t));
+         c->name = strndup(p, len);
+         c->parent = n;
+         c->fd = -1;
+         prop_set_str(c, "name", c->name);
+         for (cp = &n->child; *cp != NULL; cp = &(*cp)->peer);
+         *cp = c;
+      }
+
+      n = c;
+   }
+
+   return n;
+}
+
+
+static inst_t *
+inst_new(node_t *n,
+         inst_kind_t kind)
+{
+   inst_t *i = xmalloc(sizeof(inst_t));
+
+   i->node = n;
+   i->kind = kind;
+   return i;
+}
+
+
+static int
+claim_add(uint32_t base,
+          uint32_t len)
+{
+   unsigned i;
+
+   if (len == 0 || base < RAM_BASE || base + len > ram_top ||
+       base + len < base || claim_count == MAX_CLAIMS) {
+      return -1;
+   }
+
+   for (i = 0; i < claim_count; i++) {
+      if (base < claims[i].base + claims[i].len &&
+          claims[i].base < base + len) {
+         return -1;
+      }
+   }
+
+   claims[claim_count].base = base;
+   claims[claim_count].len = len;
+   claim_count++;
+   return 0;
+}
+
+
+static void
+claim_release(uint32_t base)
+{
+   unsigned i;
+
+   for (i = 0; i < claim_count; i++) {
+      if (claims[i].base == base) {
+         claims[i] = claims[--claim_count];
+         return;
+      }
+   }
+}
+
+
+static uint32_t
+claim(uint32_t virt,
+      uint32_t len,
+      uint32_t align)
+{
+   uint32_t base;
+
+   if (align == 0) {
+      return claim_add(virt, len) == 0 ? virt : (uint32_t) -1;
+   }
+
+   for (base = RAM_BASE; base + len <= ram_top && base + len > base;
+        base += align) {
+      if (claim_add(base, len) == 0) {
+         return base;
+      }
+   }
+
+   return (uint32_t) -1;
+}
+
+
+static int32_t
+disk_read(inst_t *i,
+          void *buf,
+          uint32_t len)
+{
+   ssize_t got;
+
+   emu_reads++;
+   if (i->pos != i->next) {
+      emu_seeks++;
+      emu_us += media->seek_us;
+   }
+
+   got = pread(i->node->fd, buf, len, i->pos);
+   if (got < 0) {
+      return -1;
+   }
+
+   if (media->kbps != 0) {
+      emu_us += (uint64_t) got * 1000000 / ((uint64_t) media->kbps * 1024);
+   }
+
+   emu_bytes += got;
+   i->pos += got;
+   i->next = i->pos;
+   return got;
+}
+
+
+/*
+ * The loader writes \r\n line ends, and a NUL after every
+ * printk, none of which a host terminal or log wants.
+ */
+static void
+console_write(const char *buf,
+              uint32_t len)
+{
+   while (len--) {
+      if (*buf != '\0' && *buf != '\r') {
+         putchar(*buf);
+      }
+
+      buf++;
+   }
+}
+
+
+static void
+call_method(of_args_t *a)
+{
+   char *method = PTR(a, 0);
+   inst_t *i = PTR(a, 1);
+   uint32_t n;
+   int32_t got;
+
+   RET(a, 0, -1);
+   if (a->nargs < 2 || a->nret < 1) {
+      return;
+   }
+
+   if (!strcmp(method, "block-size") && a->nret > 1) {
+      RET(a, 0, 0);
+      RET(a, 1, 512);
+   } else if (!strcmp(method, "max-transfer") && a->nret > 1) {
+      RET(a, 0, 0);
+      RET(a, 1, media->max_transfer);
+   } else if (!strcmp(method, "read-blocks") && a->nret > 1 &&
+              a->nargs == 5 && i->kind == INST_DISK) {
+      /*
+       * ( addr block# #blocks -- #read )
+       */
+      n = CELL(a, 2);
+      i->pos = (uint64_t) CELL(a, 3) * 512;
+      got = disk_read(i, PTR(a, 4), n * 512);
+      RET(a, 0, 0);
+      RET(a, 1, got < 0 ? 0 : got / 512);
+   } else if (!strcmp(method, "claim") && a->nret > 1 && a->nargs == 5) {
+      RET(a, 0, 0);
+      RET(a, 1, claim(CELL(a, 4), CELL(a, 3), CELL(a, 2)));
+   } else if (!strcmp(method, "release") || !strcmp(method, "unmap") ||
+              !strcmp(method, "map")) {
+      RET(a, 0, 0);
+   } else if (verbose) {
+      fprintf(stderr, "ofemu: unknown method '%s'\n", method);
+   }
+}
+
+
+/*
+ * The client interface.
+ */
+void
+ofemu_entry(void *args)
+{
+   of_args_t *a = args;
+   char *s = a->service;
+   node_t *n;
+   inst_t *i;
+   prop_t *p;
+   int len;
+   char *path;
+
+   emu_calls++;
+   emu_us += call_us;
+
+   if (verbose) {
+      fprintf(stderr, "ofemu: %s\n", s);
+   }
+
+   if (!strcmp(s, "finddevice")) {
+      n = node_find(PTR(a, 0), 0);
+      RET_PTR(a, 0, n == NULL ? (void *) -1 : n);
+   } else if (!strcmp(s, "getprop") || !strcmp(s, "getproplen")) {
+      n = PTR(a, 0);
+      p = n == NULL || n == (void *) -1 ? NULL : prop_find(n, PTR(a, 1));
+      if (p == NULL) {
+         RET(a, 0, -1);
+      } else {
+         if (!strcmp(s, "getprop")) {
+            len = CELL(a, 3) < (uint32_t) p->len ? (int) CELL(a, 3) : p->len;
+            memcpy(PTR(a, 2), p->value, len);
+         }
+
+         RET(a, 0, p->len);
+      }
+   } else if (!strcmp(s, "nextprop")) {
+      n = PTR(a, 0);
+      p = n->props;
+      if (PTR(a, 1) != NULL && *(char *) PTR(a, 1) != '\0') {
+         p = prop_find(n, PTR(a, 1));
+         p = p == NULL ? NULL : p->next;
+      }
+
+      if (p != NULL) {
+         strncpy(PTR(a, 2), p->name, 31);
+         ((char *) PTR(a, 2))[31] = '\0';
+      }
+
+      RET(a, 0, p != NULL);
+   } else if (!strcmp(s, "setprop")) {
+      prop_set(PTR(a, 0), PTR(a, 1), PTR(a, 2), CELL(a, 3));
+      RET(a, 0, CELL(a, 3));
+   } else if (!strcmp(s, "child") || !strcmp(s, "peer") ||
+              !strcmp(s, "parent")) {
+      n = PTR(a, 0);
+      if (n == NULL) {
+         n = s[0] == 'p' && s[1] == 'e' ? root : NULL;
+      } else if (!strcmp(s, "child")) {
+         n = n->child;
+      } else if (!strcmp(s, "peer")) {
+         n = n->peer;
+      } else {
+         n = n->parent;
+      }
+
+      RET_PTR(a, 0, n);
+   } else if (!strcmp(s, "instance-to-package")) {
+      i = PTR(a, 0);
+      RET_PTR(a, 0, i == NULL ? (void *) -1 : i->node);
+   } else if (!strcmp(s, "open")) {
+      path = PTR(a, 0);
+      n = node_find(path, 0);
+      i = NULL;
+      if (n != NULL) {
+         i = inst_new(n, n->fd >= 0 ? INST_DISK : INST_OTHER);
+      }
+
+      RET_PTR(a, 0, i);
+   } else if (!strcmp(s, "close")) {
+      i = PTR(a, 0);
+      if (i != console) {
+         free(i);
+      }
+   } else if (!strcmp(s, "seek")) {
+      i = PTR(a, 0);
+      i->pos = ((uint64_t) CELL(a, 1) << 32) | CELL(a, 2);
+      RET(a, 0, i->kind == INST_DISK && i->pos <= i->node->size ? 0 : -1);
+   } else if (!strcmp(s, "read")) {
+      i = PTR(a, 0);
+      if (i->kind == INST_DISK) {
+         RET(a, 0, disk_read(i, PTR(a, 1), CELL(a, 2)));
+      } else if (i->kind == INST_CONSOLE && keys != NULL &&
+                 *keys != '\0' && emu_us >= keys_us) {
+         *(char *) PTR(a, 1) = *keys++;
+         RET(a, 0, 1);
+      } else {
+         /*
+          * Nothing typed.
+          */
+         RET(a, 0, i->kind == INST_CONSOLE ? 0 : -1);
+      }
+   } else if (!strcmp(s, "write")) {
+      i = PTR(a, 0);
+      if (i->kind == INST_CONSOLE) {
+         console_write(PTR(a, 1), CELL(a, 2));
+      }
+
+      RET(a, 0, CELL(a, 2));
+   } else if (!strcmp(s, "claim")) {
+      RET(a, 0, claim(CELL(a, 0), CELL(a, 1), CELL(a, 2)));
+   } else if (!strcmp(s, "release")) {
+      claim_release(CELL(a, 0));
+   } else if (!strcmp(s, "call-method")) {
+      call_method(a);
+   } else if (!strcmp(s, "milliseconds")) {
+      RET(a, 0, emu_us / 1000);
+   } else if (!strcmp(s, "interpret")) {
+      fprintf(stderr, "ofemu: interpret '%s'\n", (char *) PTR(a, 0));
+      RET(a, 0, 0);
+   } else if (!strcmp(s, "enter")) {
+      fprintf(stderr, "ofemu: enter\n");
+   } else if (!strcmp(s, "exit")) {
+      fflush(stdout);
+      exit(0);
+   } else {
+      fprintf(stderr, "ofemu: unknown service '%s'\n", s);
+      if (a->nret != 0) {
+         RET(a, 0, -1);
+      }
+   }
+}
+
+
+uint32_t
+host_mftb(void)
+{
+   return emu_us;
+}
+
+
+uint32_t
+ofemu_wall_us(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+void
+ofemu_report(uint32_t wall_us)
+{
+   fflush(stdout);
+   fprintf(stderr, "ofemu: %u calls, %u reads, %u seeks, %llu bytes, "
+           "%llu us modelled, %u us host\n",
+           emu_calls, emu_reads, emu_seeks,
+           (unsigned long long) emu_bytes,
+           (unsigned long long) emu_us, wall_us);
+}
+
+
+/*
+ * Tree file lines are "path [property [value]]". A value is a
+ * quoted string or any number of 32-bit cells. Lines starting
+ * with # are comments.
+ */
+static int
+load_tree(const char *file)
+{
+   FILE *f;
+   char line[1024];
+   char *path;
+   char *name;
+   char *value;
+   char *end;
+   uint32_t cells[64];
+   unsigned count;
+   node_t *n;
+   unsigned lineno = 0;
+
+   f = fopen(file, "r");
+   if (f == NULL) {
+      perror(file);
+      return -1;
+   }
+
+   while (fgets(line, sizeof(line), f) != NULL) {
+      lineno++;
+      line[strcspn(line, "\r\n")] = '\0';
+      path = strtok(line, " \t");
+      if (path == NULL || path[0] == '#') {
+         continue;
+      }
+
+      n = node_find(path, 1);
+      name = strtok(NULL, " \t");
+      if (name == NULL) {
+         continue;
+      }
+
+      value = strtok(NULL, "");
+      if (value == NULL) {
+         prop_set(n, name, "", 0);
+         continue;
+      }
+
+      value += strspn(value, " \t");
+      if (value[0] == '"') {
+         end = strrchr(value + 1, '"');
+         if (end == NULL) {
+            fprintf(stderr, "%s:%u: unterminated string\n", file, lineno);
+            fclose(f);
+            return -1;
+         }
+
+         *end = '\0';
+         prop_set_str(n, name, value + 1);
+         continue;
+      }
+
+      for (count = 0; *value != '\0' && count < 64; count++) {
+         cells[count] = strtoul(value, &end, 0);
+         if (end == value) {
+            fprintf(stderr, "%s:%u: bad value\n", file, lineno);
+            fclose(f);
+            return -1;
+         }
+
+         value = end + strspn(end, " \t");
+      }
+
+      prop_set(n, name, cells, count * sizeof(uint32_t));
+   }
+
+   fclose(f);
+   return 0;
+}
+
+
+/*
+ * A disk is "path=image". A path without a leading / becomes
+ * an alias for /emu/<path>.
+ */
+static int
+add_disk(char *arg)
+{
+   char *image = strchr(arg, '=');
+   char path[256];
+   struct stat st;
+   node_t *n;
+
+   if (image == NULL) {
+      return -1;
+   }
+
+   *image++ = '\0';
+   if (arg[0] != '/') {
+      snprintf(path, sizeof(path), "/emu/%s", arg);
+      prop_set_str(aliases, arg, path);
+   } else {
+      snprintf(path, sizeof(path), "%s", arg);
+   }
+
+   n = node_find(path, 1);
+   n->fd = open(image, O_RDONLY);
+   if (n->fd < 0 || fstat(n->fd, &st) < 0) {
+      perror(image);
+      return -1;
+   }
+
+   n->size = st.st_size;
+   prop_set_str(n, "device_type", "block");
+   return 0;
+}
+
+
+static void
+build_tree(void)
+{
+   node_t *cpu;
+   node_t *mem;
+   node_t *con;
+   uint32_t reg[2];
+
+   root = xmalloc(sizeof(node_t));
+   root->name = "";
+   root->fd = -1;
+
+   prop_set_str(root, "model", firmware->model);
+   prop_set_str(root, "compatible", firmware->model);
+   prop_set_str(node_find("/openprom", 1), "model", firmware->version);
+
+   chosen = node_find("/chosen", 1);
+   options = node_find("/options", 1);
+   aliases = node_find("/aliases", 1);
+   prop_set_str(chosen, "bootargs", "");
+   prop_set_str(options, "boot-file", "");
+   prop_set_str(options, "boot-device", "");
+
+   mem = node_find("/memory@0", 1);
+   reg[0] = 0;
+   reg[1] = ram_top;
+   prop_set(mem, "reg", reg, sizeof(reg));
+   prop_set_str(mem, "device_type", "memory");
+
+   cpu = node_find("/cpus/PowerPC,750@0", 1);
+   prop_set_str(cpu, "device_type", "cpu");
+   prop_set_cell(cpu, "timebase-frequency", 1000000);
+   prop_set_cell(cpu, "d-cache-block-size", 32);
+   prop_set_cell(cpu, "i-cache-block-size", 32);
+
+   con = node_find("/emu/console", 1);
+   console = inst_new(con, INST_CONSOLE);
+
+   prop_set_ptr(chosen, "stdout", console);
+   prop_set_ptr(chosen, "stdin", console);
+   prop_set_ptr(chosen, "cpu", inst_new(cpu, INST_OTHER));
+   prop_set_ptr(chosen, "mmu", inst_new(cpu, INST_OTHER));
+   prop_set_ptr(chosen, "memory", inst_new(mem, INST_OTHER));
+}
+
+
+static void
+usage(char *name)
+{
+   unsigned i;
+
+   fprintf(stderr,
+           "Usage: %s [options] [!command ...]\n"
+           "  -f firmware   firmware profile:",
+           name);
+   for (i = 0; i < sizeof(firmwares) / sizeof(firmwares[0]); i++) {
+      fprintf(stderr, " %s", firmwares[i].name);
+   }
+
+   fprintf(stderr, "\n  -m media      media profile:");
+   for (i = 0; i < sizeof(medias) / sizeof(medias[0]); i++) {
+      fprintf(stderr, " %s", medias[i].name);
+   }
+
+   fprintf(stderr,
+           "\n"
+           "  -c us         per call latency, instead of the profile's\n"
+           "  -r MB         RAM size (%u)\n"
+           "  -d path=image add a disk, a path without / is an alias\n"
+           "  -t file       device tree additions, 'path [prop [value]]'\n"
+           "  -a args       /chosen/bootargs, e.g. 'hd:3 -- root=/dev/sda3'\n"
+           "  -k ms:keys    type keys at the console once ms have passed\n"
+           "  -v            log every client interface call\n",
+           RAM_DEFAULT_MB);
+   exit(1);
+}
+
+
+/*
+ * Returns the index of the first command argument.
+ */
+int
+ofemu_configure(int argc,
+                char **argv)
+{
+   int c;
+   unsigned i;
+   unsigned ram_mb = RAM_DEFAULT_MB;
+   int custom_call_us = -1;
+   char *bootargs = "";
+   void *ram;
+
+   while ((c = getopt(argc, argv, "f:m:c:r:d:t:a:k:vh")) != -1) {
+      switch (c) {
+      case 'f':
+         for (i = 0; i < sizeof(firmwares) / sizeof(firmwares[0]); i++) {
+            if (!strcmp(optarg, firmwares[i].name)) {
+               firmware = &firmwares[i];
+               break;
+            }
+         }
+
+         if (i == sizeof(firmwares) / sizeof(firmwares[0])) {
+            usage(argv[0]);
+         }
+         break;
+      case 'm':
+         for (i = 0; i < sizeof(medias) / sizeof(medias[0]); i++) {
+            if (!strcmp(optarg, medias[i].name)) {
+               media = &medias[i];
+               break;
+            }
+         }
+
+         if (i == sizeof(medias) / sizeof(medias[0])) {
+            usage(argv[0]);
+         }
+         break;
+      case 'c':
+         custom_call_us = atoi(optarg);
+         break;
+      case 'r':
+         ram_mb = atoi(optarg);
+         if (ram_mb * 0x100000 < RAM_BASE + FW_SIZE + 0x800000 ||
+             ram_mb > RAM_MAX_MB) {
+            usage(argv[0]);
+         }
+         break;
+      case 'a':
+         bootargs = optarg;
+         break;
+      case 'k':
+         keys_us = strtoull(optarg, &keys, 0) * 1000;
+         if (*keys++ != ':') {
+            usage(argv[0]);
+         }
+         break;
+      case 'v':
+         verbose = 1;
+         break;
+      case 'd':
+      case 't':
+         /*
+          * Need the tree first.
+          */
+         break;
+      default:
+         usage(argv[0]);
+      }
+   }
+
+   call_us = custom_call_us >= 0 ? (unsigned) custom_call_us :
+      firmware->call_us;
+   ram_top = ram_mb * 0x100000;
+   build_tree();
+   prop_set_str(chosen, "bootargs", bootargs);
+
+   optind = 1;
+   while ((c = getopt(argc, argv, "f:m:c:r:d:t:a:k:vh")) != -1) {
+      if (c == 'd' && add_disk(optarg) != 0) {
+         usage(argv[0]);
+      } else if (c == 't' && load_tree(optarg) != 0) {
+         exit(1);
+      }
+   }
+
+   /*
+    * The loader claims at fixed addresses, so RAM has to be
+    * mapped right there.
+    */
+   ram = mmap((void *) RAM_BASE, ram_top - RAM_BASE,
+              PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if (ram != (void *) RAM_BASE) {
+      fprintf(stderr, "ofemu: couldn't map RAM at 0x%x\n", RAM_BASE);
+      exit(1);
+   }
+
+   claim_add(ram_top - FW_SIZE, FW_SIZE);
+   return optind;
+}
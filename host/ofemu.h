@@ -0,0 +1,36 @@
+/*
+ * OF client interface emulator for the hosted build.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef QUIK_OFEMU_H
+#define QUIK_OFEMU_H
+
+/*
+ * Only plain types here, as this is shared between code built
+ * against the loader headers and code built against the host
+ * C library.
+ */
+
+int ofemu_configure(int argc, char **argv);
+void ofemu_entry(void *args);
+uint32_t host_mftb(void);
+uint32_t ofemu_wall_us(void);
+void ofemu_report(uint32_t wall_us);
+
+#endif /* QUIK_OFEMU_H */
@@ -0,0 +1,161 @@
+#!/bin/bash
+#
+# Smoke test for the hosted loader.
+#
+#   test.sh [iquik-host options]
+#
+# Builds a small Mac-partitioned ext2 disk image holding a kernel,
+# an initrd and a quik.conf, then has iquik-host parse the
+# configuration, load the kernel and initrd, and print !iostat,
+# and checks what comes out. Options go to iquik-host, so
+# 'test.sh -m ata' runs the same checks with a different disk
+# model. Run by 'make check'.
+#
+# Needs mke2fs from e2fsprogs 1.43 or later.
+#
+# Copyright 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+#
+
+set -e
+
+HOST=${HOST:-$(dirname "$0")/iquik-host}
+MAP_BLOCKS=64
+KERNEL_TEXT=1048576
+INITRD_LEN=1500000
+
+failed=0
+
+be16()
+{
+   printf "$(printf '\\%03o\\%03o' $((($1 >> 8) & 255)) $(($1 & 255)))"
+}
+
+be32()
+{
+   be16 $((($1 >> 16) & 65535))
+   be16 $(($1 & 65535))
+}
+
+#
+# Non-zero filler, as mke2fs -d turns all-zero blocks into holes.
+#
+fill()
+{
+   yes iquik | head -c $1
+}
+
+#
+# mkelf FILE BYTES - a PowerPC kernel image with BYTES of text.
+#
+mkelf()
+{
+   {
+      printf '\177ELF\001\002\001\000\000\000\000\000\000\000\000\000'
+      be16 2; be16 20; be32 1
+      be32 0xc0000000; be32 52; be32 0; be32 0
+      be16 52; be16 32; be16 1; be16 40; be16 0; be16 0
+      be32 1; be32 0x10000; be32 0xc0000000; be32 0
+      be32 $2; be32 $2; be32 5; be32 0x10000
+   } > "$1"
+   truncate -s 65536 "$1"
+   fill $2 >> "$1"
+}
+
+#
+# mkentry START COUNT NAME TYPE - one 512 byte partition map entry.
+#
+mkentry()
+{
+   {
+      be16 0x504d; be16 0; be32 2; be32 $1; be32 $2
+      printf '%s' $3; head -c $((32 - ${#3})) /dev/zero
+      printf '%s' $4; head -c $((32 - ${#4})) /dev/zero
+      be32 0; be32 $2; be32 0x37
+      head -c 420 /dev/zero
+   }
+}
+
+#
+# mkdisk DISK STAGE - an ext2 file system with the contents of
+# STAGE, in partition 2 of a Mac partitioned disk.
+#
+mkdisk()
+{
+   local disk=$1
+   local fs=$1.fs
+   local blocks
+
+   mke2fs -q -F -t ext2 -b 1024 -d "$2" "$fs" 8M > /dev/null
+   blocks=$(($(stat -c %s "$fs") / 512))
+
+   {
+      be16 0x4552; be16 512; be32 $((MAP_BLOCKS + blocks))
+   } > "$disk"
+   truncate -s 512 "$disk"
+   mkentry 1 $((MAP_BLOCKS - 1)) Apple Apple_partition_map >> "$disk"
+   mkentry $MAP_BLOCKS $blocks Linux Apple_UNIX_SVR2 >> "$disk"
+   truncate -s $((MAP_BLOCKS * 512)) "$disk"
+   cat "$fs" >> "$disk"
+   rm -f "$fs"
+}
+
+#
+# check WHAT PATTERN - complain unless the last run's output has
+# a line matching PATTERN.
+#
+check()
+{
+   if grep -q -- "$2" <<< "$out"; then
+      echo "ok: $1"
+   else
+      echo "FAILED: $1 (no '$2')"
+      failed=1
+   fi
+}
+
+[ -x "$HOST" ] || { echo "$HOST not built, try 'make host'" >&2; exit 1; }
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+mkdir -p "$dir/stage/boot" "$dir/stage/etc"
+mkelf "$dir/stage/boot/vmlinux" $KERNEL_TEXT
+fill $INITRD_LEN > "$dir/stage/boot/initrd"
+cat > "$dir/stage/etc/quik.conf" <<EOF
+timeout=50
+default=linux
+image=/boot/vmlinux
+   label=linux
+   initrd=/boot/initrd
+   append="root=/dev/sda3"
+image=/boot/vmlinux.old
+   label=old
+EOF
+mkdisk "$dir/disk.img" "$dir/stage"
+
+out=$("$HOST" "$@" -d hd="$dir/disk.img" -a hd:2 \
+   '!conf /etc/quik.conf' '!load /boot/vmlinux /boot/initrd' \
+   '!iostat' 2>&1) || {
+   echo "FAILED: iquik-host exited with $?"
+   exit 1
+}
+
+#
+# Drop the spinner.
+#
+out=$(tr '\r' '\n' <<< "$out" | sed 's/.\x08//g')
+
+check "config parsed" "^Default: linux$"
+check "both images listed" "^linux  *old"
+check "kernel loaded" \
+   "^Kernel: 0x$(printf %x $KERNEL_TEXT) @ 0x[0-9a-f]*, entry 0x[0-9a-f]*$"
+check "initrd loaded" "^Initrd: 0x$(printf %X $INITRD_LEN) @ 0x[0-9A-F]*$"
+
+#
+# !iostat has to agree with what the emulator saw reaching the disk.
+#
+reads=$(sed -n 's/.*ofemu: [0-9]* calls, \([0-9]*\) reads, \([0-9]*\) seeks.*/\1 \2/p' <<< "$out")
+check "!iostat reads and seeks" \
+   "^ *${reads% *} reads, 0 errors, ${reads#* } seeks,"
+
+exit $failed
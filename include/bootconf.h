@@ -0,0 +1,162 @@
+/*
+ * bootconf.h - quik.conf items, and quik.conf compiled by the installer.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef QUIK_BOOTCONF_H
+#define QUIK_BOOTCONF_H
+
+/*
+ * Everything quik.conf can say. An item is valid among the global
+ * options, within an image section or both, and is either a flag
+ * or takes a value.
+ */
+#define CFG_IN_OPTIONS  (1 << 0)
+#define CFG_IN_IMAGE    (1 << 1)
+#define CFG_FLAG        (1 << 2)
+
+#define QUIK_CFG_LIST                                                   \
+   QUIK_CFG_DEF(CFG_IMAGE, "image", CFG_IN_IMAGE)                       \
+   QUIK_CFG_DEF(CFG_LABEL, "label", CFG_IN_IMAGE)                       \
+   QUIK_CFG_DEF(CFG_ALIAS, "alias", CFG_IN_IMAGE)                       \
+   QUIK_CFG_DEF(CFG_DEVICE, "device", CFG_IN_OPTIONS | CFG_IN_IMAGE)    \
+   QUIK_CFG_DEF(CFG_PARTITION, "partition", CFG_IN_OPTIONS | CFG_IN_IMAGE) \
+   QUIK_CFG_DEF(CFG_DEFAULT, "default", CFG_IN_OPTIONS)                 \
+   QUIK_CFG_DEF(CFG_TIMEOUT, "timeout", CFG_IN_OPTIONS)                 \
+   QUIK_CFG_DEF(CFG_MESSAGE, "message", CFG_IN_OPTIONS)                 \
+   QUIK_CFG_DEF(CFG_ROOT, "root", CFG_IN_OPTIONS | CFG_IN_IMAGE)        \
+   QUIK_CFG_DEF(CFG_RAMDISK, "ramdisk", CFG_IN_OPTIONS | CFG_IN_IMAGE)  \
+   QUIK_CFG_DEF(CFG_READ_ONLY, "read-only",                             \
+                CFG_IN_OPTIONS | CFG_IN_IMAGE | CFG_FLAG)               \
+   QUIK_CFG_DEF(CFG_READ_WRITE, "read-write",                           \
+                CFG_IN_OPTIONS | CFG_IN_IMAGE | CFG_FLAG)               \
+   QUIK_CFG_DEF(CFG_APPEND, "append", CFG_IN_OPTIONS | CFG_IN_IMAGE)    \
+   QUIK_CFG_DEF(CFG_LITERAL, "literal", CFG_IN_IMAGE)                   \
+   QUIK_CFG_DEF(CFG_INITRD, "initrd", CFG_IN_OPTIONS | CFG_IN_IMAGE)    \
+   QUIK_CFG_DEF(CFG_OLD_KERNEL, "old-kernel", CFG_IN_IMAGE | CFG_FLAG)  \
+   QUIK_CFG_DEF(CFG_PAUSE_AFTER, "pause-after",                         \
+                CFG_IN_OPTIONS | CFG_IN_IMAGE | CFG_FLAG)               \
+   QUIK_CFG_DEF(CFG_PAUSE_MESSAGE, "pause-message",                     \
+                CFG_IN_OPTIONS | CFG_IN_IMAGE)                          \
+   QUIK_CFG_DEF(CFG_INIT_CODE, "init-code", CFG_IN_OPTIONS)             \
+   QUIK_CFG_DEF(CFG_INIT_MESSAGE, "init-message", CFG_IN_OPTIONS)       \
+   QUIK_CFG_DEF(CFG_QUIET, "quiet", CFG_IN_OPTIONS | CFG_FLAG)          \
+   QUIK_CFG_DEF(CFG_PROGRESS, "progress", CFG_IN_OPTIONS | CFG_FLAG)    \
+   /* Only for compatibility - unused. */                               \
+   QUIK_CFG_DEF(CFG_INITRD_SIZE, "initrd-size", CFG_IN_OPTIONS)         \
+
+#define QUIK_CFG_DEF(e, name, where) e,
+typedef enum {
+  QUIK_CFG_LIST
+  CFG_MAX
+} cfg_item_t;
+#undef QUIK_CFG_DEF
+
+/*
+ * 'iquik -c' appends this to the boot block, at the first 4 byte
+ * boundary after the preboot script's NUL (or after PREBOOT_MAGIC,
+ * if there is no script). Without -c a zero word goes there
+ * instead, so a blob left in RAM by an earlier boot isn't picked up.
+ *
+ * Everything is big-endian. The header is followed by the entries
+ * and then NUL-terminated strings. Entries are the item/value pairs
+ * of quik.conf in file order, as byte offsets from the start of the
+ * header. A value of 0 means the item had none (a flag). An "image"
+ * item starts a new image, as in quik.conf.
+ *
+ * conf_ino, conf_mtime and conf_len describe the quik.conf that was
+ * compiled, found at conf_path on its file system. If the loader
+ * finds something else there, the blob is stale and it parses the
+ * text file instead.
+ *
+ * The entries are followed by the files pinned for the default
+ * image (its kernel and initrd), and then by their extents.
+ */
+#define BOOTCONF_MAGIC   0x51434f4e  /* 'QCON' */
+#define BOOTCONF_VERSION 3
+
+typedef struct bootconf {
+   uint32_t magic;
+   uint32_t version;
+
+   /* Header, entries and strings. */
+   uint32_t len;
+
+   /* bootconf_sum of everything after the header. */
+   uint32_t checksum;
+   uint32_t conf_ino;
+   uint32_t conf_mtime;
+   uint32_t conf_len;
+   uint32_t conf_path;
+   uint32_t entries;
+   uint32_t files;
+   uint32_t extents;
+} bootconf_t;
+
+typedef struct {
+   uint32_t item;
+   uint32_t value;
+} bootconf_entry_t;
+
+/*
+ * Where a file was when the installer ran, so the loader can read
+ * it without walking any directories. It is only used if the file
+ * system UUID, and the inode's generation, mtime, ctime, size and
+ * block map all still match. Replacing or rewriting the file
+ * changes the first few, and tools that move its blocks without
+ * touching the data, like e4defrag or resize2fs, change the
+ * block map.
+ */
+typedef struct {
+
+   /* The path as quik.conf gives it, a string offset. */
+   uint32_t path;
+   uint8_t uuid[16];
+   uint32_t ino;
+   uint32_t generation;
+   uint32_t mtime;
+   uint32_t ctime;
+   uint32_t size;
+
+   /* bootconf_sum of i_block[], as it is on disk. */
+   uint32_t block_sum;
+
+   /* Index of the first extent, and how many there are. */
+   uint32_t extent;
+   uint32_t extents;
+} bootconf_file_t;
+
+/*
+ * Extents are in file order and don't overlap. Anything
+ * between them is a hole.
+ */
+typedef struct {
+
+   /* Bytes into the file. */
+   uint32_t offset;
+
+   /* 512-byte sectors from the start of the file system. */
+   uint32_t sector;
+   uint32_t len;
+} bootconf_extent_t;
+
+static inline uint32_t
+bootconf_sum(const unsigned char *p,
+             uint32_t len)
+{
+   uint32_t sum = 0;
+
+   while (len--) {
+      sum = ((sum << 5) | (sum >> 27)) + *p++;
+   }
+
+   return sum;
+}
+
+#endif /* QUIK_BOOTCONF_H */
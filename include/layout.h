@@ -35,3 +35,10 @@
  * Anything loaded by iquik gets put above this address.
  */
 #define LOAD_BASE       0x800000
+
+/*
+ * Once MALLOC_SIZE is used up, the heap grows by claiming
+ * from the top of RAM down to here, leaving the space above
+ * LOAD_BASE for the kernel and initrd.
+ */
+#define MALLOC_GROW_FLOOR 0x2000000
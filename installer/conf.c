@@ -0,0 +1,630 @@
+/*
+ * Compiles quik.conf into the binary form the loader can use
+ * without mounting anything or parsing text, see bootconf.h.
+ *
+ * The tokenizer follows loader/cfg.c, so the loader ends up with
+ * the same item/value pairs either way. Mistakes the loader would
+ * only warn about at boot are fatal here.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <endian.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <bootconf.h>
+#include "conf.h"
+
+#define MAX_TOKEN 200
+
+static struct {
+   char *name;
+   unsigned where;
+} items[CFG_MAX] = {
+#define QUIK_CFG_DEF(e, n, w) [e] = { .name = n, .where = w },
+   QUIK_CFG_LIST
+#undef QUIK_CFG_DEF
+};
+
+static struct {
+   char *name;
+   char *p;
+   char *end;
+   unsigned line;
+} in;
+
+static struct {
+   bootconf_entry_t *entries;
+   unsigned count;
+   bootconf_file_t *files;
+   unsigned file_count;
+   bootconf_extent_t *extents;
+   unsigned extent_count;
+   char *strings;
+   size_t strings_len;
+} out;
+
+/*
+ * Just enough about the images to find what the
+ * default one loads.
+ */
+typedef struct {
+   char *image;
+   char *label;
+   char *alias;
+   char *initrd;
+} image_t;
+
+static struct {
+   image_t *images;
+   unsigned count;
+   char *def;
+   char *initrd;
+} conf;
+
+
+static void
+conf_fatal(char *msg)
+{
+   fatal("%s near line %u in '%s'", msg, in.line, in.name);
+}
+
+
+static int
+next(void)
+{
+   if (in.p == in.end) {
+      return EOF;
+   }
+
+   return *in.p++;
+}
+
+
+static void
+again(int ch)
+{
+   if (ch != EOF) {
+      in.p--;
+   }
+}
+
+
+/*
+ * Returns NULL at EOF, "=" for an equals sign.
+ */
+static char *
+get_token(void)
+{
+   int ch;
+   bool escaped = false;
+   size_t len = 0;
+   static char buf[MAX_TOKEN + 1];
+
+   for (;;) {
+      while (ch = next(), ch == ' ' || ch == '\t' || ch == '\n') {
+         if (ch == '\n') {
+            in.line++;
+         }
+      }
+
+      if (ch == EOF) {
+         return NULL;
+      }
+
+      if (ch != '#') {
+         break;
+      }
+
+      while (ch = next(), ch != '\n') {
+         if (ch == EOF) {
+            return NULL;
+         }
+      }
+
+      in.line++;
+   }
+
+   if (ch == '=') {
+      return "=";
+   }
+
+   if (ch == '"') {
+      while (len < MAX_TOKEN) {
+         ch = next();
+         if (ch == EOF) {
+            conf_fatal("EOF in quoted string");
+         }
+
+         if (ch == '"') {
+            buf[len] = '\0';
+            return buf;
+         }
+
+         if (ch == '\n') {
+            conf_fatal("Newline is not allowed in quoted strings");
+         }
+
+         if (ch == '\\') {
+            ch = next();
+            switch (ch) {
+            case '"':
+            case '\\':
+               break;
+            case '\n':
+               in.line++;
+               while (ch = next(), ch == ' ' || ch == '\t');
+               again(ch);
+               ch = ' ';
+               break;
+            case 'n':
+               ch = '\n';
+               break;
+            default:
+               conf_fatal("Bad use of \\ in quoted string");
+            }
+         }
+
+         buf[len++] = ch;
+      }
+
+      conf_fatal("Quoted string is too long");
+   }
+
+   while (len < MAX_TOKEN) {
+      if (escaped) {
+         if (ch == EOF) {
+            conf_fatal("\\ precedes EOF");
+         }
+
+         if (ch == '\n') {
+            in.line++;
+         } else {
+            buf[len++] = ch == '\t' ? ' ' : ch;
+         }
+
+         escaped = false;
+      } else {
+         if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '#' ||
+             ch == '=' || ch == EOF) {
+            again(ch);
+            buf[len] = '\0';
+            return buf;
+         }
+
+         escaped = ch == '\\';
+         if (!escaped) {
+            buf[len++] = ch;
+         }
+      }
+
+      ch = next();
+   }
+
+   conf_fatal("Token is too long");
+   return NULL;
+}
+
+
+/*
+ * Strings go after the entries, so offsets are fixed up
+ * once the entry count is known. Identical strings are
+ * stored once.
+ */
+static uint32_t
+add_string(char *s)
+{
+   size_t off = 0;
+   size_t len = strlen(s) + 1;
+
+   while (off < out.strings_len) {
+      if (!strcmp(out.strings + off, s)) {
+         return off;
+      }
+
+      off += strlen(out.strings + off) + 1;
+   }
+
+   out.strings = realloc(out.strings, out.strings_len + len);
+   if (out.strings == NULL) {
+      fatal("Out of memory compiling '%s'", in.name);
+   }
+
+   memcpy(out.strings + out.strings_len, s, len);
+   out.strings_len += len;
+   return off;
+}
+
+
+static void
+add_entry(char *item,
+          char *value)
+{
+   out.entries = realloc(out.entries,
+                         (out.count + 1) * sizeof(bootconf_entry_t));
+   if (out.entries == NULL) {
+      fatal("Out of memory compiling '%s'", in.name);
+   }
+
+   /*
+    * Offsets are relative to the string area for now, with
+    * values biased by one so 0 still means no value.
+    */
+   out.entries[out.count].item = add_string(item);
+   out.entries[out.count].value = value == NULL ? 0 : add_string(value) + 1;
+   out.count++;
+}
+
+
+static void
+remember(cfg_item_t i,
+         char *value)
+{
+   char **slot;
+   image_t *im;
+
+   if (i == CFG_IMAGE) {
+      conf.images = realloc(conf.images,
+                            (conf.count + 1) * sizeof(image_t));
+      if (conf.images == NULL) {
+         fatal("Out of memory compiling '%s'", in.name);
+      }
+
+      memset(&conf.images[conf.count++], 0, sizeof(image_t));
+   }
+
+   im = conf.count != 0 ? &conf.images[conf.count - 1] : NULL;
+   switch (i) {
+   case CFG_IMAGE:
+      slot = &im->image;
+      break;
+   case CFG_LABEL:
+      slot = &im->label;
+      break;
+   case CFG_ALIAS:
+      slot = &im->alias;
+      break;
+   case CFG_INITRD:
+      slot = im != NULL ? &im->initrd : &conf.initrd;
+      break;
+   case CFG_DEFAULT:
+      slot = &conf.def;
+      break;
+   default:
+      return;
+   }
+
+   *slot = strdup(value);
+   if (*slot == NULL) {
+      fatal("Out of memory compiling '%s'", in.name);
+   }
+}
+
+
+static void
+parse(void)
+{
+   char *tok;
+   char item[MAX_TOKEN + 1];
+   char value[MAX_TOKEN + 1];
+   bool has_value;
+   unsigned where = CFG_IN_OPTIONS;
+   cfg_item_t i;
+
+   tok = get_token();
+   while (tok != NULL) {
+      if (!strcmp(tok, "=")) {
+         conf_fatal("Syntax error");
+      }
+
+      strcpy(item, tok);
+      has_value = false;
+      tok = get_token();
+      if (tok != NULL && !strcmp(tok, "=")) {
+         tok = get_token();
+         if (tok == NULL) {
+            conf_fatal("Value expected at EOF");
+         }
+
+         if (!strcmp(tok, "=")) {
+            conf_fatal("Syntax error");
+         }
+
+         strcpy(value, tok);
+         has_value = true;
+         tok = get_token();
+      }
+
+      for (i = 0; i < CFG_MAX; i++) {
+         if (!strcasecmp(items[i].name, item)) {
+            break;
+         }
+      }
+
+      if (i == CFG_IMAGE) {
+         where = CFG_IN_IMAGE;
+      }
+
+      if (i == CFG_MAX || (items[i].where & where) == 0) {
+         fatal("Unknown item '%s' near line %u in '%s'%s", item, in.line,
+               in.name, where == CFG_IN_IMAGE ?
+               " (global items go before the first image)" : "");
+      }
+
+      if (has_value == ((items[i].where & CFG_FLAG) != 0)) {
+         fatal("'%s' %s near line %u in '%s'", items[i].name,
+               has_value ? "doesn't have a value" : "needs a value",
+               in.line, in.name);
+      }
+
+      add_entry(items[i].name, has_value ? value : NULL);
+      if (has_value) {
+         remember(i, value);
+      }
+   }
+}
+
+
+/*
+ * The path of file on the file system it lives on, which is
+ * what the loader will look it up as, and where that file
+ * system is mounted ("" for /).
+ */
+static char *
+fs_path(char *file,
+        char **root)
+{
+   char *path;
+   char *dir;
+   char *parent;
+   char *result;
+   struct stat st;
+   struct stat pst;
+
+   path = realpath(file, NULL);
+   if (path == NULL || stat(path, &st) < 0) {
+      fatal("Couldn't resolve '%s'", file);
+   }
+
+   /*
+    * Walk up until the parent of the directory is on another
+    * device, making the directory the file system root.
+    */
+   dir = strrchr(path, '/');
+   while (dir != path) {
+      *dir = '\0';
+      parent = strrchr(path, '/');
+      *parent = '\0';
+      if (stat(parent == path ? "/" : path, &pst) < 0) {
+         fatal("Couldn't stat '%s'", path);
+      }
+
+      *parent = '/';
+      *dir = '/';
+      if (pst.st_dev != st.st_dev) {
+         break;
+      }
+
+      dir = parent;
+   }
+
+   result = strdup(dir);
+   *dir = '\0';
+   *root = path;
+   return result;
+}
+
+
+/*
+ * The label the loader would show for an image.
+ */
+static char *
+image_label(image_t *im)
+{
+   if (im->label != NULL) {
+      return im->label;
+   }
+
+   if (strrchr(im->image, '/') != NULL) {
+      return strrchr(im->image, '/') + 1;
+   }
+
+   return im->image;
+}
+
+
+static image_t *
+default_image(void)
+{
+   unsigned i;
+   image_t *im;
+
+   if (conf.count == 0) {
+      return NULL;
+   }
+
+   if (conf.def == NULL) {
+      return &conf.images[0];
+   }
+
+   for (i = 0; i < conf.count; i++) {
+      im = &conf.images[i];
+      if (!strcmp(image_label(im), conf.def) ||
+          (im->alias != NULL && !strcmp(im->alias, conf.def))) {
+         return im;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ * Pin path, as quik.conf gives it, if it is on the same file
+ * system as quik.conf. Paths naming a device are left alone.
+ */
+static void
+pin(char *path,
+    char *root,
+    dev_t dev)
+{
+   char *host;
+   bootconf_file_t *f;
+   bootconf_extent_t *extents;
+   unsigned count;
+
+   if (path == NULL || path[0] != '/') {
+      return;
+   }
+
+   host = pin_resolve(root, path);
+   if (host == NULL) {
+      printf("Not pinning '%s': can't resolve it\n", path);
+      return;
+   }
+
+   out.files = realloc(out.files,
+                       (out.file_count + 1) * sizeof(bootconf_file_t));
+   if (out.files == NULL) {
+      fatal("Out of memory compiling '%s'", in.name);
+   }
+
+   f = &out.files[out.file_count];
+   if (pin_file(host, dev, f, &extents)) {
+      count = be32toh(f->extents);
+      out.extents = realloc(out.extents, (out.extent_count + count) *
+                            sizeof(bootconf_extent_t));
+      if (out.extents == NULL) {
+         fatal("Out of memory compiling '%s'", in.name);
+      }
+
+      memcpy(out.extents + out.extent_count, extents,
+             count * sizeof(bootconf_extent_t));
+      f->path = add_string(path);
+      f->extent = htobe32(out.extent_count);
+      out.extent_count += count;
+      out.file_count++;
+      printf("Pinned '%s', %u extents\n", path, count);
+      free(extents);
+   }
+
+   free(host);
+}
+
+
+void *
+conf_compile(char *file,
+             size_t *len)
+{
+   FILE *f;
+   char *text;
+   char *path;
+   char *root;
+   struct stat st;
+   image_t *im;
+   bootconf_t *bc;
+   bootconf_entry_t *e;
+   bootconf_file_t *files;
+   uint32_t strings;
+   uint32_t path_off;
+   unsigned i;
+
+   f = fopen(file, "r");
+   if (f == NULL) {
+      fatal("Couldn't open configuration file '%s'", file);
+   }
+
+   if (fstat(fileno(f), &st) < 0) {
+      fatal("Couldn't stat '%s'", file);
+   }
+
+   text = malloc(st.st_size);
+   if (text == NULL ||
+       fread(text, 1, st.st_size, f) != st.st_size) {
+      fatal("Couldn't read '%s'", file);
+   }
+
+   fclose(f);
+
+   in.name = file;
+   in.p = text;
+   in.end = text + st.st_size;
+   in.line = 1;
+   parse();
+   free(text);
+
+   path = fs_path(file, &root);
+   path_off = add_string(path);
+
+   im = default_image();
+   if (im != NULL) {
+      pin(im->image, root, st.st_dev);
+      pin(im->initrd != NULL ? im->initrd : conf.initrd, root, st.st_dev);
+   }
+
+   strings = sizeof(bootconf_t) + out.count * sizeof(bootconf_entry_t) +
+      out.file_count * sizeof(bootconf_file_t) +
+      out.extent_count * sizeof(bootconf_extent_t);
+   *len = (strings + out.strings_len + 3) & ~3;
+   bc = calloc(1, *len);
+   if (bc == NULL) {
+      fatal("Out of memory compiling '%s'", file);
+   }
+
+   e = (bootconf_entry_t *) (bc + 1);
+   for (i = 0; i < out.count; i++) {
+      e[i].item = htobe32(strings + out.entries[i].item);
+      if (out.entries[i].value != 0) {
+         e[i].value = htobe32(strings + out.entries[i].value - 1);
+      }
+   }
+
+   files = (bootconf_file_t *) (e + out.count);
+   for (i = 0; i < out.file_count; i++) {
+      files[i] = out.files[i];
+      files[i].path = htobe32(strings + out.files[i].path);
+   }
+
+   memcpy(files + out.file_count, out.extents,
+          out.extent_count * sizeof(bootconf_extent_t));
+   memcpy((char *) bc + strings, out.strings, out.strings_len);
+   bc->magic = htobe32(BOOTCONF_MAGIC);
+   bc->version = htobe32(BOOTCONF_VERSION);
+   bc->len = htobe32(*len);
+   bc->conf_ino = htobe32(st.st_ino);
+   bc->conf_mtime = htobe32(st.st_mtime);
+   bc->conf_len = htobe32(st.st_size);
+   bc->conf_path = htobe32(strings + path_off);
+   bc->entries = htobe32(out.count);
+   bc->files = htobe32(out.file_count);
+   bc->extents = htobe32(out.extent_count);
+   bc->checksum = htobe32(bootconf_sum((unsigned char *) (bc + 1),
+                                       *len - sizeof(bootconf_t)));
+
+   free(path);
+   free(root);
+   free(out.entries);
+   free(out.files);
+   free(out.extents);
+   free(out.strings);
+   return bc;
+}
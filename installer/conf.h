@@ -0,0 +1,38 @@
+/*
+ * quik.conf compiler and file pinning.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef QUIK_CONF_H
+#define QUIK_CONF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <bootconf.h>
+
+void fatal(char *fmt, ...);
+char *find_dev(int number);
+void *conf_compile(char *file, size_t *len);
+char *pin_resolve(char *root, char *path);
+bool pin_file(char *file,
+              dev_t dev,
+              bootconf_file_t *f,
+              bootconf_extent_t **extents);
+
+#endif /* QUIK_CONF_H */
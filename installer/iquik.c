@@ -40,6 +40,7 @@
 #include <layout.h>
 #include <endian.h>
 #include <stdbool.h>
+#include "conf.h"
 
 #define DFL_BOOTBLOCK   "/boot/iquik.b"
 
@@ -244,6 +245,7 @@ void usage(char *s)
           " -d           install boot code to alternate device (e.g. /dev/fd0)\n"
           " -v           verbose mode\n"
           " -p script    preboot script\n"
+          " -c conf      compile conf (e.g. /etc/quik.conf) into the boot code\n"
           " -T           test mode (no actual writes)\n"
           " -V           show version\n" ,s);
    exit(1);
@@ -253,6 +255,7 @@ void usage(char *s)
 void install_stage(char *device,
                    char *filename,
                    char *preboot,
+                   char *conf,
                    ssize_t *stage_size,
                    off_t doff)
 {
@@ -263,6 +266,9 @@ void install_stage(char *device,
    FILE *fp;
    off_t off;
    ssize_t code_size;
+   ssize_t conf_off;
+   size_t conf_size;
+   void *conf_data;
    struct stat st;
    uint32_t magic;
 
@@ -300,12 +306,33 @@ void install_stage(char *device,
       *stage_size = code_size;
    }
 
+   /*
+    * The compiled configuration, or a zero word in its place,
+    * goes at the next 4 byte boundary. See bootconf.h.
+    */
+   if (conf != NULL) {
+      conf_data = conf_compile(conf, &conf_size);
+   } else {
+      conf_data = NULL;
+      conf_size = sizeof(uint32_t);
+   }
+
+   conf_off = (*stage_size + 3) & ~3;
+   *stage_size = conf_off + conf_size;
+   if (*stage_size > IQUIK_SIZE) {
+      fatal("Boot code is %zu bytes, can't be more than %u",
+            *stage_size, IQUIK_SIZE);
+   }
+
    if (verbose) {
       printf("Code size: %zu\nStage size: %zu bytes\n",
              code_size, *stage_size);
+      if (conf != NULL) {
+         printf("Compiled '%s' into %zu bytes\n", conf, conf_size);
+      }
    }
 
-   buff = malloc(*stage_size);
+   buff = calloc(1, *stage_size);
    if (buff == NULL) {
       fatal("Couldn't alloc %u to read '%s'", *stage_size, filename);
    }
@@ -327,13 +354,15 @@ void install_stage(char *device,
                filename,  be32toh(magic));
       }
 
-      rc = fread(buff + code_size, 1, *stage_size - code_size - 1, fpp);
+      rc = fread(buff + code_size, 1, st.st_size, fpp);
       if (rc <= 0) {
          fatal("Couldn't read preboot script from '%s'", preboot);
       }
+   }
 
-
-      buff[*stage_size - 1] = '\0';
+   if (conf_data != NULL) {
+      memcpy(buff + conf_off, conf_data, conf_size);
+      free(conf_data);
    }
 
    off = doff * 512;
@@ -469,6 +498,7 @@ int main(int argc,char **argv)
    char *basedev = NULL;
    char *name = DFL_BOOTBLOCK;
    char *preboot = NULL;
+   char *conf = NULL;
    int c;
    struct stat st1;
    int version = 0;
@@ -477,11 +507,14 @@ int main(int argc,char **argv)
    ssize_t secsize = 0;
    ssize_t stage_size = 0;
 
-   while ((c = getopt(argc, argv, "p:b:d:r:vVTh")) != -1) {
+   while ((c = getopt(argc, argv, "p:c:b:d:r:vVTh")) != -1) {
       switch(c) {
       case 'p':
          preboot = optarg;
          break;
+      case 'c':
+         conf = optarg;
+         break;
       case 'b':
          name = optarg;
          break;
@@ -520,6 +553,10 @@ int main(int argc,char **argv)
    }
 
    name = chrootcpy(new_root, name);
+   if (conf != NULL) {
+      conf = chrootcpy(new_root, conf);
+   }
+
    if (stat(name, &st1) < 0) {
       fatal("Cannot open iQUIK boot block '%s'", name);
    }
@@ -566,7 +603,7 @@ int main(int argc,char **argv)
    }
 
    read_sb(basedev, &part_index, &doff, &secsize);
-   install_stage(basedev, name, preboot, &stage_size, doff);
+   install_stage(basedev, name, preboot, conf, &stage_size, doff);
    make_bootable(basedev,
                  secsize,
                  part_index,
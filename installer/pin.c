@@ -0,0 +1,408 @@
+/*
+ * Records where a file is on disk, so the loader can read it
+ * without walking directories, see bootconf.h.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <bootconf.h>
+#include "conf.h"
+
+#define EXT2_SB_OFFSET    1024
+#define EXT2_SB_SIZE      1024
+#define EXT2_SB_FIRST_DATA_BLOCK 20
+#define EXT2_SB_LOG_BLOCK_SIZE 24
+#define EXT2_SB_INODES_PER_GROUP 40
+#define EXT2_SB_MAGIC     56
+#define EXT2_SB_REV_LEVEL 76
+#define EXT2_SB_INODE_SIZE 88
+#define EXT2_SB_INCOMPAT  96
+#define EXT2_SB_UUID      104
+#define EXT2_SB_DESC_SIZE 254
+#define EXT2_MAGIC        0xEF53
+#define EXT2_INCOMPAT_64BIT 0x80
+
+#define EXT2_BG_SIZE      32
+#define EXT2_BG_INODE_TABLE 8
+
+#define EXT2_INODE_CTIME  12
+#define EXT2_INODE_BLOCK  40
+#define EXT2_INODE_BLOCK_LEN 60
+
+/* Same as the loader's limit.  */
+#define MAX_SYMLINKS      8
+
+#define FIEMAP_BATCH      64
+
+/*
+ * Extents the loader can't just read off the disk.
+ */
+#define FIEMAP_UNUSABLE (FIEMAP_EXTENT_UNKNOWN |                \
+                         FIEMAP_EXTENT_DELALLOC |               \
+                         FIEMAP_EXTENT_ENCODED |                \
+                         FIEMAP_EXTENT_DATA_ENCRYPTED |         \
+                         FIEMAP_EXTENT_NOT_ALIGNED |            \
+                         FIEMAP_EXTENT_DATA_INLINE |            \
+                         FIEMAP_EXTENT_DATA_TAIL |              \
+                         FIEMAP_EXTENT_UNWRITTEN)
+
+
+/*
+ * Resolves path the way the loader will, as if root were /, so
+ * that absolute symlinks don't escape the file system. Returns
+ * the host path, or NULL if path doesn't resolve.
+ */
+char *
+pin_resolve(char *root,
+            char *path)
+{
+   char cur[PATH_MAX];
+   char rest[PATH_MAX];
+   char link[PATH_MAX];
+   char host[PATH_MAX];
+   char *name;
+   char *slash;
+   size_t len;
+   ssize_t n;
+   unsigned links = 0;
+   struct stat st;
+
+   cur[0] = '\0';
+   if (strlen(path) >= sizeof(rest)) {
+      return NULL;
+   }
+
+   strcpy(rest, path);
+   name = rest;
+   while (*name != '\0') {
+      slash = strchr(name, '/');
+      if (slash != NULL) {
+         *slash = '\0';
+      }
+
+      len = strlen(cur);
+      if (!strcmp(name, "..")) {
+         if (strrchr(cur, '/') != NULL) {
+            *strrchr(cur, '/') = '\0';
+         }
+      } else if (*name != '\0' && strcmp(name, ".") != 0) {
+         if (len + strlen(name) + 2 > sizeof(cur)) {
+            return NULL;
+         }
+
+         strcat(cur, "/");
+         strcat(cur, name);
+         snprintf(host, sizeof(host), "%s%s", root, cur);
+         if (lstat(host, &st) < 0) {
+            return NULL;
+         }
+
+         if (S_ISLNK(st.st_mode)) {
+            if (++links > MAX_SYMLINKS) {
+               return NULL;
+            }
+
+            n = readlink(host, link, sizeof(link) - 1);
+            if (n < 0) {
+               return NULL;
+            }
+
+            link[n] = '\0';
+            if (link[0] == '/') {
+               cur[0] = '\0';
+            } else {
+               cur[len] = '\0';
+            }
+
+            /*
+             * The rest of the path goes after the link.
+             */
+            if (slash != NULL) {
+               if (n + strlen(slash + 1) + 2 > sizeof(link)) {
+                  return NULL;
+               }
+
+               strcat(link, "/");
+               strcat(link, slash + 1);
+            }
+
+            strcpy(rest, link);
+            name = rest;
+            continue;
+         }
+      }
+
+      if (slash == NULL) {
+         break;
+      }
+
+      name = slash + 1;
+   }
+
+   snprintf(host, sizeof(host), "%s%s", root, cur);
+   return strdup(host);
+}
+
+
+#define LE16(p) ((p)[0] | (p)[1] << 8)
+#define LE32(p) ((uint32_t) LE16(p) | (uint32_t) LE16((p) + 2) << 16)
+
+
+/*
+ * Fills in the file system UUID, and the ctime and block map sum
+ * of inode ino, read off the device the way the loader will see
+ * them. The file system keeps its metadata in the device's page
+ * cache, so this sees changes that aren't written back yet.
+ */
+static bool
+pin_inode(dev_t dev,
+          ino_t ino,
+          bootconf_file_t *f)
+{
+   int fd;
+   char *device;
+   uint8_t sb[EXT2_SB_SIZE];
+   uint8_t bg[EXT2_BG_SIZE];
+   uint8_t inode[EXT2_INODE_BLOCK + EXT2_INODE_BLOCK_LEN];
+   uint32_t block_size;
+   uint32_t per_group;
+   uint32_t inode_size = 128;
+   uint32_t desc_size = EXT2_BG_SIZE;
+   off_t off;
+
+   device = find_dev(dev);
+   if (device == NULL) {
+      return false;
+   }
+
+   fd = open(device, O_RDONLY);
+   if (fd < 0) {
+      return false;
+   }
+
+   if (pread(fd, sb, sizeof(sb), EXT2_SB_OFFSET) != sizeof(sb) ||
+       LE16(sb + EXT2_SB_MAGIC) != EXT2_MAGIC) {
+      goto fail;
+   }
+
+   block_size = 1024 << LE32(sb + EXT2_SB_LOG_BLOCK_SIZE);
+   per_group = LE32(sb + EXT2_SB_INODES_PER_GROUP);
+   if (LE32(sb + EXT2_SB_REV_LEVEL) != 0) {
+      inode_size = LE16(sb + EXT2_SB_INODE_SIZE);
+   }
+
+   if ((LE32(sb + EXT2_SB_INCOMPAT) & EXT2_INCOMPAT_64BIT) != 0 &&
+       LE16(sb + EXT2_SB_DESC_SIZE) != 0) {
+      desc_size = LE16(sb + EXT2_SB_DESC_SIZE);
+   }
+
+   if (per_group == 0 || inode_size < sizeof(inode)) {
+      goto fail;
+   }
+
+   ino--;
+   off = (off_t) (LE32(sb + EXT2_SB_FIRST_DATA_BLOCK) + 1) * block_size +
+      (off_t) (ino / per_group) * desc_size;
+   if (pread(fd, bg, sizeof(bg), off) != sizeof(bg)) {
+      goto fail;
+   }
+
+   off = (off_t) LE32(bg + EXT2_BG_INODE_TABLE) * block_size +
+      (off_t) (ino % per_group) * inode_size;
+   if (pread(fd, inode, sizeof(inode), off) != sizeof(inode)) {
+      goto fail;
+   }
+
+   close(fd);
+   memcpy(f->uuid, sb + EXT2_SB_UUID, sizeof(f->uuid));
+   f->ctime = htobe32(LE32(inode + EXT2_INODE_CTIME));
+   f->block_sum = htobe32(bootconf_sum(inode + EXT2_INODE_BLOCK,
+                                       EXT2_INODE_BLOCK_LEN));
+   return true;
+
+fail:
+   close(fd);
+   return false;
+}
+
+
+static bool
+pin_add_extent(bootconf_extent_t **extents,
+               unsigned *count,
+               struct fiemap_extent *fe,
+               off_t size)
+{
+   bootconf_extent_t *x;
+   uint64_t len = fe->fe_length;
+
+   /*
+    * The last block can go past the end of the file.
+    */
+   if (fe->fe_logical + len > size) {
+      len = size - fe->fe_logical;
+   }
+
+   if ((fe->fe_physical & 511) != 0 ||
+       (fe->fe_physical >> 9) > UINT32_MAX ||
+       len > UINT32_MAX) {
+      return false;
+   }
+
+   /*
+    * Merge with the previous extent if it's contiguous on disk,
+    * as long as the loader's reads stay sector aligned.
+    */
+   x = *count ? &(*extents)[*count - 1] : NULL;
+   if (x != NULL &&
+       (be32toh(x->len) & 511) == 0 &&
+       be32toh(x->offset) + be32toh(x->len) == fe->fe_logical &&
+       be32toh(x->sector) + (be32toh(x->len) >> 9) ==
+       (fe->fe_physical >> 9) &&
+       be32toh(x->len) + len <= UINT32_MAX) {
+      x->len = htobe32(be32toh(x->len) + len);
+      return true;
+   }
+
+   *extents = realloc(*extents, (*count + 1) * sizeof(bootconf_extent_t));
+   if (*extents == NULL) {
+      fatal("Out of memory pinning file");
+   }
+
+   x = &(*extents)[(*count)++];
+   x->offset = htobe32(fe->fe_logical);
+   x->sector = htobe32(fe->fe_physical >> 9);
+   x->len = htobe32(len);
+   return true;
+}
+
+
+/*
+ * Fills in everything but the path and the index of the first
+ * extent. Returns false, with a message, if file can't be pinned.
+ */
+bool
+pin_file(char *file,
+         dev_t dev,
+         bootconf_file_t *f,
+         bootconf_extent_t **extents)
+{
+   int fd;
+   unsigned i;
+   unsigned count = 0;
+   unsigned generation;
+   bool last = false;
+   struct stat st;
+   struct fiemap *fm;
+   struct fiemap_extent *fe;
+
+   *extents = NULL;
+   fd = open(file, O_RDONLY);
+   if (fd < 0 || fstat(fd, &st) < 0) {
+      printf("Not pinning '%s': can't open it\n", file);
+      goto fail;
+   }
+
+   if (!S_ISREG(st.st_mode) || st.st_dev != dev ||
+       st.st_size > UINT32_MAX) {
+      printf("Not pinning '%s': not a file the loader can see\n", file);
+      goto fail;
+   }
+
+   if (ioctl(fd, FS_IOC_GETVERSION, &generation) < 0) {
+      printf("Not pinning '%s': not on ext2\n", file);
+      goto fail;
+   }
+
+   fm = calloc(1, sizeof(*fm) + FIEMAP_BATCH * sizeof(*fe));
+   if (fm == NULL) {
+      fatal("Out of memory pinning '%s'", file);
+   }
+
+   /*
+    * FIEMAP_FLAG_SYNC, so nothing is waiting for blocks.
+    */
+   while (!last) {
+      fm->fm_length = FIEMAP_MAX_OFFSET - fm->fm_start;
+      fm->fm_flags = FIEMAP_FLAG_SYNC;
+      fm->fm_extent_count = FIEMAP_BATCH;
+      if (ioctl(fd, FS_IOC_FIEMAP, fm) < 0) {
+         printf("Not pinning '%s': can't map its blocks\n", file);
+         free(fm);
+         goto fail;
+      }
+
+      if (fm->fm_mapped_extents == 0) {
+         break;
+      }
+
+      for (i = 0; i < fm->fm_mapped_extents; i++) {
+         fe = &fm->fm_extents[i];
+         if ((fe->fe_flags & FIEMAP_UNUSABLE) != 0 ||
+             fe->fe_logical >= st.st_size ||
+             !pin_add_extent(extents, &count, fe, st.st_size)) {
+            printf("Not pinning '%s': can't read it directly\n", file);
+            free(fm);
+            goto fail;
+         }
+
+         last = (fe->fe_flags & FIEMAP_EXTENT_LAST) != 0;
+      }
+
+      fe = &fm->fm_extents[fm->fm_mapped_extents - 1];
+      fm->fm_start = fe->fe_logical + fe->fe_length;
+   }
+
+   free(fm);
+
+   /*
+    * After FIEMAP_FLAG_SYNC, so the block map is final.
+    */
+   if (!pin_inode(dev, st.st_ino, f)) {
+      printf("Not pinning '%s': can't read its inode\n", file);
+      goto fail;
+   }
+
+   close(fd);
+   f->ino = htobe32(st.st_ino);
+   f->generation = htobe32(generation);
+   f->mtime = htobe32(st.st_mtime);
+   f->size = htobe32(st.st_size);
+   f->extents = htobe32(count);
+   return true;
+
+fail:
+   if (fd >= 0) {
+      close(fd);
+   }
+
+   free(*extents);
+   *extents = NULL;
+   return false;
+}
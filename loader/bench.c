@@ -0,0 +1,333 @@
+/*
+ * Device read benchmark.
+ *
+ * Times reads from a partition across a sweep of transfer sizes,
+ * sequential and random, through both disk_read() and the
+ * "read-blocks" method if the device has one. Also times a
+ * client interface call that does nothing, as a baseline.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "quik.h"
+#include "prom.h"
+#include "disk.h"
+#include "part.h"
+#include "file.h"
+#include "commands.h"
+
+#ifdef CONFIG_TINY
+#error "CONFIG_BENCH needs the timebase support left out by CONFIG_TINY"
+#endif /* CONFIG_TINY */
+
+/* Bytes read per size and pattern, unless given. */
+#define BENCH_DEFAULT_TOTAL  SIZE_1M
+
+/* Used if the device has no max-transfer method. */
+#define BENCH_DEFAULT_MAX_XFER (64 * 1024)
+
+/* Largest transfer size tried, whatever the device says. */
+#define BENCH_MAX_XFER SIZE_1M
+
+/* Reads per measurement, at least. */
+#define BENCH_MIN_READS 8
+
+#define BENCH_NULL_CALLS 1000
+
+typedef enum {
+   BENCH_READ,
+   BENCH_READ_BLOCKS,
+} bench_method_t;
+
+typedef struct {
+   part_t *part;
+   char *buf;
+   uint32_t block_size;
+   unsigned block_bits;
+   uint32_t seed;
+} bench_t;
+
+
+static uint32_t
+bench_rand(bench_t *b)
+{
+   uint32_t r;
+
+   b->seed = b->seed * 1103515245 + 12345;
+   r = b->seed & 0xffff0000;
+   b->seed = b->seed * 1103515245 + 12345;
+   return r | (b->seed >> 16);
+}
+
+
+static uint32_t
+bench_kbs(length_t bytes,
+          uint32_t us)
+{
+   length_t kb = bytes >> 10;
+
+   if (us < 1000) {
+      return 0;
+   }
+
+   /*
+    * No 64-bit division here, so trade precision
+    * for range on big runs.
+    */
+   if (kb < 42949) {
+      return kb * 100000 / (us / 10);
+   }
+
+   return kb * 1000 / (us / 1000);
+}
+
+
+static quik_err_t
+bench_read_blocks(bench_t *b,
+                  offset_t offset,
+                  length_t len)
+{
+   uint32_t nblocks = len / b->block_size;
+
+   /*
+    * ( addr block# #blocks -- #read ), topmost
+    * argument first.
+    */
+   if (call_prom("call-method", 5, 2, "read-blocks",
+                 b->part->dev, nblocks,
+                 (uint32_t) (offset >> b->block_bits),
+                 b->buf) != 0) {
+      return ERR_OF_METHOD;
+   }
+
+   if ((uint32_t) prom_ret(1) != nblocks) {
+      return ERR_DEV_SHORT_READ;
+   }
+
+   return ERR_NONE;
+}
+
+
+static quik_err_t
+bench_run(bench_t *b,
+          bench_method_t method,
+          bool random,
+          length_t size,
+          length_t total)
+{
+   unsigned i;
+   unsigned reads;
+   uint32_t us;
+   uint32_t t;
+   uint32_t start;
+   uint32_t max = 0;
+   offset_t off;
+   uint32_t span;
+   quik_err_t err = ERR_NONE;
+
+   reads = total / size;
+   if (reads < BENCH_MIN_READS) {
+      reads = BENCH_MIN_READS;
+   }
+
+   /*
+    * In sectors, as the loader has no 64-bit division.
+    */
+   span = (uint32_t) (b->part->len >> SECTOR_BITS) / (size >> SECTOR_BITS);
+   if (span < reads) {
+      return ERR_PART_BEYOND;
+   }
+
+   us = 0;
+   for (i = 0; i < reads; i++) {
+      off = random ? (offset_t) (bench_rand(b) % span) : i;
+      off = b->part->start + off * size;
+
+      start = prom_ticks();
+      if (method == BENCH_READ) {
+         if (disk_read(b->part->dev, b->buf, size, off) != size) {
+            err = ERR_DEV_SHORT_READ;
+         }
+      } else {
+         err = bench_read_blocks(b, off, size);
+      }
+
+      t = prom_ticks_to_us(prom_ticks() - start);
+      if (err != ERR_NONE) {
+         return err;
+      }
+
+      us += t;
+      if (t > max) {
+         max = t;
+      }
+   }
+
+   printk("%u %s %s: %u KB/s, %u us avg, %u us max\n", size,
+          random ? "rand" : "seq",
+          method == BENCH_READ ? "read" : "read-blocks",
+          bench_kbs(size * reads, us), us / reads, max);
+   return ERR_NONE;
+}
+
+
+static void
+bench_null_call(void)
+{
+   unsigned i;
+   uint32_t start;
+   uint32_t us;
+
+   start = prom_ticks();
+   for (i = 0; i < BENCH_NULL_CALLS; i++) {
+      call_prom("milliseconds", 0, 1);
+   }
+
+   us = prom_ticks_to_us(prom_ticks() - start);
+   printk("Null client interface call: %u.%u us\n",
+          us / BENCH_NULL_CALLS,
+          (us % BENCH_NULL_CALLS) / (BENCH_NULL_CALLS / 10));
+}
+
+
+static quik_err_t
+cmd_bench(char *args)
+{
+   bench_t b;
+   char *word;
+   char *rest;
+   char *pattern = "all";
+   length_t size;
+   length_t max_xfer = BENCH_DEFAULT_MAX_XFER;
+   length_t total = BENCH_DEFAULT_TOTAL;
+   path_t *path = NULL;
+   quik_err_t err;
+   bench_method_t method;
+   bool has_blocks;
+   unsigned r;
+
+   memset(&b, 0, sizeof(b));
+   word = args;
+   word_split(&word, &rest);
+   if (word != NULL && strchr(word, ':') != NULL) {
+      err = file_path(word, &bi->default_dev, &path);
+      if (err != ERR_NONE) {
+         return err;
+      }
+
+      word = rest;
+      word_split(&word, &rest);
+   } else {
+      err = env_dev_is_valid(&bi->default_dev);
+      if (err != ERR_NONE) {
+         return err;
+      }
+   }
+
+   if (word != NULL) {
+      total = strtol(word, NULL, 0);
+      if (total == 0) {
+         err = ERR_CMD_BAD_PARAM;
+         goto out;
+      }
+
+      word = rest;
+      word_split(&word, &rest);
+   }
+
+   if (word != NULL) {
+      pattern = word;
+      if (strcmp(pattern, "seq") && strcmp(pattern, "rand") &&
+          strcmp(pattern, "all")) {
+         err = ERR_CMD_BAD_PARAM;
+         goto out;
+      }
+   }
+
+   b.seed = get_ms();
+   b.part = malloc(sizeof(part_t));
+   if (b.part == NULL) {
+      err = ERR_NO_MEM;
+      goto out;
+   }
+
+   memset(b.part, 0, sizeof(part_t));
+   err = part_open(path ? path->device : bi->default_dev.device,
+                   path ? path->part : bi->default_dev.part,
+                   b.part);
+   if (err != ERR_NONE) {
+      goto out;
+   }
+
+   if (call_prom("call-method", 2, 2, "max-transfer",
+                 b.part->dev) == 0 &&
+       (length_t) prom_ret(1) >= SECTOR_SIZE) {
+      max_xfer = MIN((length_t) prom_ret(1), BENCH_MAX_XFER);
+   }
+
+   has_blocks = call_prom("call-method", 2, 2, "block-size",
+                          b.part->dev) == 0;
+   if (has_blocks) {
+      b.block_size = (uint32_t) prom_ret(1);
+      while (b.block_bits < 16 &&
+             (1 << b.block_bits) != b.block_size) {
+         b.block_bits++;
+      }
+
+      has_blocks = (1 << b.block_bits) == b.block_size;
+   }
+
+   b.buf = malloc(max_xfer);
+   if (b.buf == NULL) {
+      err = ERR_NO_MEM;
+      goto close;
+   }
+
+   printk("max-transfer %u, block-size %u\n", max_xfer, b.block_size);
+   bench_null_call();
+   for (size = SECTOR_SIZE; size <= max_xfer; size <<= 1) {
+      for (r = 0; r < 2; r++) {
+         if ((r == 0 && !strcmp(pattern, "rand")) ||
+             (r == 1 && !strcmp(pattern, "seq"))) {
+            continue;
+         }
+
+         for (method = BENCH_READ; method <= BENCH_READ_BLOCKS; method++) {
+            if (method == BENCH_READ_BLOCKS &&
+                (!has_blocks || size < b.block_size)) {
+               continue;
+            }
+
+            err = bench_run(&b, method, r == 1, size, total);
+            if (err != ERR_NONE) {
+               goto free;
+            }
+         }
+      }
+   }
+
+free:
+   free(b.buf);
+close:
+   part_close(b.part);
+out:
+   free(b.part);
+   file_path_free(path);
+   return err;
+}
+
+COMMAND(bench, cmd_bench, "benchmark reads given [device:part] [size] [seq|rand]");
@@ -22,83 +22,68 @@
 #include "quik.h"
 #include "isetjmp.h"
 #include "prom.h"
+#include "pool.h"
+#include <layout.h>
 
-typedef enum {
-   cft_strg, cft_flag, cft_end
-} CONFIG_TYPE;
+#define EOF -1
 
-typedef struct {
-   CONFIG_TYPE type;
+static struct {
    char *name;
-   void *data;
-} CONFIG;
-
-#define MAX_TOKEN 200
-#define MAX_VAR_NAME MAX_TOKEN
-#define EOF -1
+   unsigned where;
+} cfg_items[CFG_MAX] = {
+#define QUIK_CFG_DEF(e, n, w) [e] = { .name = n, .where = w },
+   QUIK_CFG_LIST
+#undef QUIK_CFG_DEF
+};
 
-CONFIG cf_options[] =
-{
-   {cft_strg, "device", NULL},
-   {cft_strg, "partition", NULL},
-   {cft_strg, "default", NULL},
-   {cft_strg, "timeout", NULL},
-   {cft_strg, "message", NULL},
-   {cft_strg, "root", NULL},
-   {cft_strg, "ramdisk", NULL},
-   {cft_flag, "read-only", NULL},
-   {cft_flag, "read-write", NULL},
-   {cft_strg, "append", NULL},
-   {cft_strg, "initrd", NULL},
-
-   /* Only for compatibility - unused. */
-   {cft_strg, "initrd-size", NULL},
-   {cft_flag, "pause-after", NULL},
-   {cft_strg, "pause-message", NULL},
-   {cft_strg, "init-code", NULL},
-   {cft_strg, "init-message", NULL},
-   {cft_end, NULL, NULL}};
-
-CONFIG cf_image[] =
-{
-   {cft_strg, "image", NULL},
-   {cft_strg, "label", NULL},
-   {cft_strg, "alias", NULL},
-   {cft_strg, "device", NULL},
-   {cft_strg, "partition", NULL},
-   {cft_strg, "root", NULL},
-   {cft_strg, "ramdisk", NULL},
-   {cft_flag, "read-only", NULL},
-   {cft_flag, "read-write", NULL},
-   {cft_strg, "append", NULL},
-   {cft_strg, "literal", NULL},
-   {cft_strg, "initrd", NULL},
-   {cft_flag, "old-kernel", NULL},
-   {cft_flag, "pause-after", NULL},
-   {cft_strg, "pause-message", NULL},
-   {cft_end, NULL, NULL}};
+/*
+ * Values are slices of the configuration buffer, which stays
+ * around, NUL-terminated in place. Flags point to flag_set.
+ */
+typedef struct cfg_image {
+   char *slots[CFG_MAX];
+   struct cfg_image *next;
+} cfg_image_t;
 
 static char flag_set;
+static char *options[CFG_MAX];
+static char **curr_slots = options;
+static cfg_image_t *images = NULL;
+static cfg_image_t **images_tail = &images;
+static POOL(image_pool, cfg_image_t, 8);
+
+/*
+ * Labels and aliases to images. Open addressing, sized to at
+ * most half full when the configuration is parsed. If there is
+ * no memory for it, lookups walk the images instead.
+ */
+typedef struct {
+   char *key;
+   cfg_image_t *image;
+} cfg_hash_t;
+
+static cfg_hash_t *label_hash;
+static unsigned label_hash_mask;
+
+/*
+ * The compiled configuration, if that's what was used.
+ */
+static bootconf_t *compiled;
+
 static char *last_token = NULL, *last_item = NULL, *last_value = NULL;
 static int line_num;
 static int back = 0;    /* can go back by one char */
 static char *currp;
 static char *endp;
 static char *file_name;
-static CONFIG *curr_table = cf_options;
 static jmp_buf env;
 
-static struct IMAGES {
-   CONFIG table[sizeof (cf_image) / sizeof (cf_image[0])];
-   struct IMAGES *next;
-} *images = NULL;
-
 void cfg_error (char *msg,...)
 {
    va_list ap;
 
    va_start (ap, msg);
-   printk ("Config file error: ");
+   printk_err ("Config file error: ");
    vprintk (msg, ap);
    va_end (ap);
    printk (" near line %d in file %s\n", line_num, file_name);
@@ -110,7 +95,7 @@ void cfg_warn (char *msg,...)
    va_list ap;
 
    va_start (ap, msg);
-   printk ("Config file warning: ");
+   printk_err ("Config file warning: ");
    vprintk (msg, ap);
    va_end (ap);
    printk (" near line %d in file %s\n", line_num, file_name);
@@ -142,9 +127,15 @@ static void again (int ch)
    back = ch;
 }
 
+/*
+ * Tokens are unescaped in place, which never needs more room
+ * than the text they came from. The character that ends a token
+ * gets overwritten by the NUL, but by then it's in 'back', and the
+ * buffer has a spare byte for a token ending at EOF.
+ */
 static char *cfg_get_token (void)
 {
-   char buf[MAX_TOKEN + 1];
+   char *token;
    char *here;
    int ch, escaped;
 
@@ -166,16 +157,18 @@ static char *cfg_get_token (void)
             return NULL;
       line_num++;
    }
+
+   /* Where ch came from, whether it was read or pushed back. */
+   token = here = currp - 1;
    if (ch == '=')
-      return strdup ("=");
+      return "=";
    if (ch == '"') {
-      here = buf;
-      while (here - buf < MAX_TOKEN) {
+      while (1) {
          if ((ch = next ()) == EOF)
             cfg_error ("EOF in quoted string");
          if (ch == '"') {
             *here = 0;
-            return strdup (buf);
+            return token;
          }
          if (ch == '\\') {
             ch = next ();
@@ -200,12 +193,9 @@ static char *cfg_get_token (void)
             cfg_error ("newline is not allowed in quoted strings");
          *here++ = ch;
       }
-      cfg_error ("Quoted string is too long");
-      return 0;      /* not reached */
    }
-   here = buf;
    escaped = 0;
-   while (here - buf < MAX_TOKEN) {
+   while (1) {
       if (escaped) {
          if (ch == EOF)
             cfg_error ("\\ precedes EOF");
@@ -219,15 +209,13 @@ static char *cfg_get_token (void)
              ch == '=' || ch == EOF) {
             again (ch);
             *here = 0;
-            return strdup (buf);
+            return token;
          }
          if (!(escaped = (ch == '\\')))
             *here++ = ch;
       }
       ch = next ();
    }
-   cfg_error ("Token is too long");
-   return 0;        /* not reached */
 }
 
 static void cfg_return_token(char *token)
@@ -269,157 +257,498 @@ static void cfg_return (char *item, char *value)
    last_value = value;
 }
 
-static int cfg_set (char *item, char *value)
+
+static cfg_item_t
+cfg_item(char *name)
 {
-   CONFIG *walk;
+   cfg_item_t i;
+
+   for (i = 0; i < CFG_MAX; i++) {
+      if (!strcasecmp(cfg_items[i].name, name)) {
+         break;
+      }
+   }
 
-   if (!strcasecmp (item, "image")) {
-      struct IMAGES **p = &images;
+   return i;
+}
+
+
+static int
+cfg_set(char *item,
+        char *value)
+{
+   cfg_item_t i;
+   cfg_image_t *image;
+   unsigned where = CFG_IN_IMAGE;
+
+   if (curr_slots == options) {
+      where = CFG_IN_OPTIONS;
+   }
 
-      while (*p) {
-         p = &((*p)->next);
+   i = cfg_item(item);
+   if (i == CFG_IMAGE) {
+      image = pool_alloc(&image_pool);
+      if (image == NULL) {
+         cfg_error("Out of memory");
       }
 
-      *p = malloc (sizeof (struct IMAGES));
-      (*p)->next = 0;
+      memset(image, 0, sizeof(cfg_image_t));
+      *images_tail = image;
+      images_tail = &image->next;
       bi->flags |= HAVE_IMAGES;
 
-      curr_table = ((*p)->table);
-      memcpy (curr_table, cf_image, sizeof (cf_image));
-   }
-
-   for (walk = curr_table; walk->type != cft_end; walk++) {
-      if (walk->name && !strcasecmp (walk->name, item)) {
-         if (value && walk->type != cft_strg)
-            cfg_warn ("'%s' doesn't have a value", walk->name);
-         else if (!value && walk->type == cft_strg)
-            cfg_warn ("Value expected for '%s'", walk->name);
-         else {
-            if (walk->data)
-               cfg_warn ("Duplicate entry '%s'", walk->name);
-            if (walk->type == cft_flag)
-               walk->data = &flag_set;
-            else if (walk->type == cft_strg)
-               walk->data = value;
+      curr_slots = image->slots;
+      where = CFG_IN_IMAGE;
+   }
+
+   if (i == CFG_MAX || (cfg_items[i].where & where) == 0) {
+      cfg_return(item, value);
+      return 0;
+   }
+
+   if (value && (cfg_items[i].where & CFG_FLAG) != 0) {
+      cfg_warn("'%s' doesn't have a value", cfg_items[i].name);
+   } else if (!value && (cfg_items[i].where & CFG_FLAG) == 0) {
+      cfg_warn("Value expected for '%s'", cfg_items[i].name);
+   } else {
+      if (curr_slots[i]) {
+         cfg_warn("Duplicate entry '%s'", cfg_items[i].name);
+      }
+
+      curr_slots[i] = value ? value : &flag_set;
+   }
+
+   return 1;
+}
+
+
+/*
+ * An image is known by its label, or failing that the last
+ * component of its path.
+ */
+static char *
+cfg_image_label(cfg_image_t *image)
+{
+   char *label = image->slots[CFG_LABEL];
+
+   if (label == NULL) {
+      label = image->slots[CFG_IMAGE];
+      if (label != NULL && strrchr(label, '/') != NULL) {
+         label = strrchr(label, '/') + 1;
+      }
+   }
+
+   return label;
+}
+
+
+static unsigned
+cfg_hash(char *key)
+{
+   unsigned h = 5381;
+
+   while (*key != '\0') {
+      h = h * 33 + *key++;
+   }
+
+   return h;
+}
+
+
+/*
+ * The first image to claim a label or alias gets it, as
+ * with a walk over the images in file order.
+ */
+static void
+cfg_hash_add(char *key,
+             cfg_image_t *image)
+{
+   cfg_hash_t *e;
+   unsigned h = cfg_hash(key);
+
+   for (;; h++) {
+      e = &label_hash[h & label_hash_mask];
+      if (e->key == NULL) {
+         e->key = key;
+         e->image = image;
+         return;
+      }
+
+      if (!strcmp(e->key, key)) {
+         return;
+      }
+   }
+}
+
+
+static void
+cfg_index(void)
+{
+   unsigned n = 0;
+   unsigned size;
+   cfg_image_t *image;
+
+   /*
+    * Up to two keys per image.
+    */
+   for (image = images; image != NULL; image = image->next) {
+      n++;
+   }
+
+   for (size = 8; size < 4 * n; size <<= 1);
+
+   free(label_hash);
+   label_hash = malloc(size * sizeof(cfg_hash_t));
+   if (label_hash == NULL) {
+      return;
+   }
+
+   memset(label_hash, 0, size * sizeof(cfg_hash_t));
+   label_hash_mask = size - 1;
+   for (image = images; image != NULL; image = image->next) {
+      if (cfg_image_label(image) != NULL) {
+         cfg_hash_add(cfg_image_label(image), image);
+      }
+
+      if (image->slots[CFG_ALIAS] != NULL) {
+         cfg_hash_add(image->slots[CFG_ALIAS], image);
+      }
+   }
+}
+
+
+static cfg_image_t *
+cfg_find(char *label)
+{
+   cfg_hash_t *e;
+   cfg_image_t *image;
+   unsigned h;
+
+   if (label_hash == NULL) {
+      for (image = images; image != NULL; image = image->next) {
+         if ((cfg_image_label(image) != NULL &&
+              !strcmp(cfg_image_label(image), label)) ||
+             (image->slots[CFG_ALIAS] != NULL &&
+              !strcmp(image->slots[CFG_ALIAS], label))) {
+            return image;
          }
+      }
 
-         break;
+      return NULL;
+   }
+
+   for (h = cfg_hash(label);; h++) {
+      e = &label_hash[h & label_hash_mask];
+      if (e->key == NULL) {
+         return NULL;
+      }
+
+      if (!strcmp(e->key, label)) {
+         return e->image;
       }
    }
-   if (walk->type != cft_end) {
-      return 1;
+}
+
+
+/*
+ * Forget whatever an earlier parse left, so a configuration
+ * that failed part way can be replaced by another.
+ */
+static void
+cfg_reset(void)
+{
+   cfg_image_t *image;
+
+   while (images != NULL) {
+      image = images;
+      images = image->next;
+      pool_free(&image_pool, image);
    }
 
-   cfg_return(item, value);
-   return 0;
+   images_tail = &images;
+   memset(options, 0, sizeof(options));
+   curr_slots = options;
+   compiled = NULL;
+   bi->flags &= ~HAVE_IMAGES;
 }
 
-int cfg_parse (char *cfg_file, char *buff, int len)
+
+/*
+ * buff must have room for len + 1 bytes, and is used in place
+ * and referenced afterwards, so it must stay around.
+ */
+int
+cfg_parse(char *cfg_file,
+          char *buff,
+          int len)
 {
+   int ret = 0;
    char *item, *value;
 
+   cfg_reset();
    file_name = cfg_file;
    currp = buff;
    endp = currp + len;
+   line_num = 1;
+   last_token = NULL;
+   last_item = NULL;
+   back = 0;
 
-   if (setjmp (env))
-      return -1;
-   while (1) {
-      if (!cfg_next (&item, &value))
-         return 0;
-      if (!cfg_set (item, value))
-         return -1;
-      free (item);
+   if (setjmp (env)) {
+      ret = -1;
+   } else {
+      while (cfg_next(&item, &value)) {
+         if (!cfg_set(item, value)) {
+            cfg_error("Unknown item '%s'", item);
+         }
+      }
    }
+
+   cfg_index();
+   return ret;
 }
 
-static char *cfg_get_strg_i (CONFIG * table, char *item)
+
+bootconf_t *
+cfg_compiled(void)
 {
-   CONFIG *walk;
+   unsigned i;
+   length_t len;
+   length_t strings;
+   bootconf_t *bc;
+   bootconf_entry_t *e;
+   bootconf_file_t *f;
+   bootconf_extent_t *extents;
+   bootconf_extent_t *x;
+   unsigned j;
+   uint32_t end;
+   vaddr_t p = (vaddr_t) preboot_script;
+
+   p = ALIGN_UP(p + strlen(preboot_script) + 1, 4);
+   if (p < IQUIK_BASE ||
+       p + sizeof(bootconf_t) > IQUIK_BASE + IQUIK_SIZE) {
+      return NULL;
+   }
 
-   for (walk = table; walk->type != cft_end; walk++)
-      if (walk->name && !strcasecmp (walk->name, item))
-         return walk->data;
-   return 0;
+   bc = (bootconf_t *) p;
+   if (be32_to_cpu(bc->magic) != BOOTCONF_MAGIC) {
+      return NULL;
+   }
+
+   len = be32_to_cpu(bc->len);
+   strings = sizeof(bootconf_t) +
+      be32_to_cpu(bc->entries) * sizeof(bootconf_entry_t) +
+      be32_to_cpu(bc->files) * sizeof(bootconf_file_t) +
+      be32_to_cpu(bc->extents) * sizeof(bootconf_extent_t);
+   if (be32_to_cpu(bc->version) != BOOTCONF_VERSION ||
+       len > IQUIK_BASE + IQUIK_SIZE - p ||
+       be32_to_cpu(bc->entries) > len ||
+       be32_to_cpu(bc->files) > len ||
+       be32_to_cpu(bc->extents) > len ||
+       strings >= len ||
+       ((char *) bc)[len - 1] != '\0' ||
+       bootconf_sum((unsigned char *) (bc + 1), len - sizeof(bootconf_t)) !=
+       be32_to_cpu(bc->checksum)) {
+      printk_err("Ignoring corrupt compiled configuration\n");
+      return NULL;
+   }
+
+   /*
+    * Strings are NUL-terminated by the check above, so all
+    * that's left is making sure the offsets point at them.
+    */
+   e = (bootconf_entry_t *) (bc + 1);
+   for (i = 0; i < be32_to_cpu(bc->entries); i++, e++) {
+      if (be32_to_cpu(e->item) < strings ||
+          be32_to_cpu(e->item) >= len ||
+          (e->value != 0 && (be32_to_cpu(e->value) < strings ||
+                             be32_to_cpu(e->value) >= len))) {
+         printk_err("Ignoring corrupt compiled configuration\n");
+         return NULL;
+      }
+   }
+
+   if (be32_to_cpu(bc->conf_path) < strings ||
+       be32_to_cpu(bc->conf_path) >= len) {
+      printk_err("Ignoring corrupt compiled configuration\n");
+      return NULL;
+   }
+
+   /*
+    * Pinned files are read straight into a buffer of their
+    * size, so extents must stay inside it.
+    */
+   f = (bootconf_file_t *) e;
+   extents = (bootconf_extent_t *) (f + be32_to_cpu(bc->files));
+   for (i = 0; i < be32_to_cpu(bc->files); i++, f++) {
+      if (be32_to_cpu(f->path) < strings ||
+          be32_to_cpu(f->path) >= len ||
+          be32_to_cpu(f->extent) > be32_to_cpu(bc->extents) ||
+          be32_to_cpu(f->extents) > be32_to_cpu(bc->extents) -
+          be32_to_cpu(f->extent)) {
+         printk_err("Ignoring corrupt compiled configuration\n");
+         return NULL;
+      }
+
+      end = 0;
+      x = extents + be32_to_cpu(f->extent);
+      for (j = 0; j < be32_to_cpu(f->extents); j++, x++) {
+         if (be32_to_cpu(x->offset) < end ||
+             be32_to_cpu(x->len) > be32_to_cpu(f->size) ||
+             be32_to_cpu(x->offset) >
+             be32_to_cpu(f->size) - be32_to_cpu(x->len)) {
+            printk_err("Ignoring corrupt compiled configuration\n");
+            return NULL;
+         }
+
+         end = be32_to_cpu(x->offset) + be32_to_cpu(x->len);
+      }
+   }
+
+   return bc;
 }
 
-char *cfg_get_strg (char *image, char *item)
+
+/*
+ * Like cfg_parse, but with the item/value pairs already split
+ * out by the installer. Strings are used in place.
+ */
+int
+cfg_parse_compiled(bootconf_t *bc)
 {
-   struct IMAGES *p;
-   char *label, *alias;
-   char *ret;
-
-   if (!image)
-      return cfg_get_strg_i (cf_options, item);
-   for (p = images; p; p = p->next) {
-      label = cfg_get_strg_i (p->table, "label");
-      if (!label) {
-         label = cfg_get_strg_i (p->table, "image");
-         alias = strrchr (label, '/');
-         if (alias)
-            label = alias + 1;
+   unsigned i;
+   int ret = 0;
+   char *item;
+   char *value;
+   bootconf_entry_t *e = (bootconf_entry_t *) (bc + 1);
+
+   cfg_reset();
+   file_name = "compiled configuration";
+   if (setjmp (env)) {
+      ret = -1;
+   } else {
+      for (i = 0; i < be32_to_cpu(bc->entries); i++, e++) {
+         line_num = i + 1;
+         item = (char *) bc + be32_to_cpu(e->item);
+         value = NULL;
+         if (e->value != 0) {
+            value = (char *) bc + be32_to_cpu(e->value);
+         }
+
+         if (!cfg_set(item, value)) {
+            cfg_error("Unknown item '%s'", item);
+         }
       }
-      alias = cfg_get_strg_i (p->table, "alias");
-      if (!strcmp (label, image) || (alias && !strcmp (alias, image))) {
-         ret = cfg_get_strg_i (p->table, item);
-         if (!ret)
-            ret = cfg_get_strg_i (cf_options, item);
-         return ret;
+   }
+
+   /*
+    * Pins are only trusted from a configuration that
+    * parsed cleanly.
+    */
+   if (ret == 0) {
+      compiled = bc;
+   }
+
+   cfg_index();
+   return ret;
+}
+
+
+/*
+ * The installer's record of where path is on the file system
+ * with uuid, if the compiled configuration is in use and has one.
+ */
+bootconf_file_t *
+cfg_pinned(char *path,
+           uint8_t *uuid,
+           bootconf_extent_t **extents)
+{
+   unsigned i;
+   bootconf_file_t *f;
+   bootconf_extent_t *x;
+
+   if (compiled == NULL || uuid == NULL) {
+      return NULL;
+   }
+
+   f = (bootconf_file_t *) ((bootconf_entry_t *) (compiled + 1) +
+                            be32_to_cpu(compiled->entries));
+   x = (bootconf_extent_t *) (f + be32_to_cpu(compiled->files));
+   for (i = 0; i < be32_to_cpu(compiled->files); i++, f++) {
+      if (!memcmp(f->uuid, uuid, sizeof(f->uuid)) &&
+          !strcmp((char *) compiled + be32_to_cpu(f->path), path)) {
+         *extents = x + be32_to_cpu(f->extent);
+         return f;
       }
    }
-   return 0;
+
+   return NULL;
 }
 
-int cfg_get_flag (char *image, char *item)
+
+char *
+cfg_get_strg(char *label,
+             cfg_item_t item)
 {
-   return !!cfg_get_strg (image, item);
+   cfg_image_t *image;
+
+   if (label == NULL) {
+      return options[item];
+   }
+
+   image = cfg_find(label);
+   if (image == NULL) {
+      return NULL;
+   }
+
+   if (image->slots[item] != NULL) {
+      return image->slots[item];
+   }
+
+   return options[item];
+}
+
+
+int
+cfg_get_flag(char *label,
+             cfg_item_t item)
+{
+   return cfg_get_strg(label, item) != NULL;
 }
 
 
-void cfg_print_images(void)
+void
+cfg_print_images(void)
 {
-   struct IMAGES *p;
-   char *label, *alias;
+   cfg_image_t *image;
    table_print_t tp;
 
    table_print_start(&tp, 3, 25);
 
-   for (p = images; p; p = p->next) {
-      label = cfg_get_strg_i (p->table, "label");
-      if (!label) {
-         label = cfg_get_strg_i(p->table, "image");
-         alias = strrchr (label, '/');
-         if (alias) {
-            label = alias + 1;
-         }
+   for (image = images; image != NULL; image = image->next) {
+      if (cfg_image_label(image) != NULL) {
+         table_print(&tp, cfg_image_label(image));
       }
 
-      alias = cfg_get_strg_i (p->table, "alias");
-      table_print(&tp, label);
-      if (alias) {
-         table_print(&tp, alias);
+      if (image->slots[CFG_ALIAS] != NULL) {
+         table_print(&tp, image->slots[CFG_ALIAS]);
       }
    }
 
    table_print_end(&tp);
 }
 
-char *cfg_get_default (void)
+
+char *
+cfg_get_default(void)
 {
-   char *label;
-   char *ret = cfg_get_strg_i (cf_options, "default");
+   if (options[CFG_DEFAULT] != NULL) {
+      return options[CFG_DEFAULT];
+   }
 
-   if (ret)
-      return ret;
-   if (!images)
-      return 0;
-   ret = cfg_get_strg_i (images->table, "label");
-   if (!ret) {
-      ret = cfg_get_strg_i (images->table, "image");
-      label = strrchr (ret, '/');
-      if (label)
-         ret = label + 1;
+   if (images == NULL) {
+      return NULL;
    }
 
-   return ret;
+   return cfg_image_label(images);
 }
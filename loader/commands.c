@@ -23,6 +23,7 @@
 #include "quik.h"
 #include "prom.h"
 #include "commands.h"
+#include "task.h"
 
 #define CMD_LENG 512
 static char *cbuff;
@@ -94,7 +95,7 @@ cmd_show_commands(void)
 }
 
 
-static quik_err_t
+quik_err_t
 cmd_dispatch(char *args)
 {
    command_t *c = &_commands;
@@ -150,7 +151,7 @@ cmd_edit(void (*tabfunc)(char *), key_t c)
    memset(cbuff, 0, sizeof(cbuff));
 
    if (c == KEY_NONE) {
-      c = getchar();
+      c = task_getchar();
    }
 
    while (c != KEY_NONE && c != '\n' && c != '\r') {
@@ -173,7 +174,7 @@ cmd_edit(void (*tabfunc)(char *), key_t c)
          ++x;
       }
 
-      c = getchar();
+      c = task_getchar();
    }
 
    putchar('\n');
@@ -31,13 +31,28 @@ typedef struct {
    char *desc;
 } command_t;
 
+#ifdef CONFIG_HOST
+/*
+ * The hosted build links with the host's linker script, which
+ * gives __start_ and __stop_ symbols for sections named like
+ * C identifiers. The alignment stops the compiler padding
+ * entries out.
+ */
+#define CMD_ATTRS section ("commands"), aligned (sizeof (void *))
+#define _commands __start_commands
+#define _commands_end __stop_commands
+#else
+#define CMD_ATTRS section (".commands")
+#endif /* CONFIG_HOST */
+
 #define COMMAND(n, f, d)                                            \
-   command_t cmd_desc_ ## n __attribute__ ((section (".commands"))) = { .name = "!"#n, .fn = f, .desc = d }
+   command_t cmd_desc_ ## n __attribute__ ((CMD_ATTRS)) = { .name = "!"#n, .fn = f, .desc = d }
 
 extern command_t _commands;
 extern command_t _commands_end;
 
 quik_err_t cmd_init(void);
+quik_err_t cmd_dispatch(char *args);
 char *cmd_edit(void (*tabfunc)(char *buf), key_t c);
 void cmd_show_commands(void);
 
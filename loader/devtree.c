@@ -0,0 +1,512 @@
+/*
+ * In-memory device tree snapshot, for the OF shim.
+ *
+ * A kernel's prom_init walks the entire device tree, and on
+ * OF 1.0.5 and 2.0 every one of those calls is slow. Instead,
+ * the tree is read once, a node at a time while the boot prompt
+ * waits for a key and the rest just before handoff, and the shim
+ * answers child/peer/parent/getprop/getproplen/nextprop from the
+ * copy. The mediabay ATA and SMP "reg" fixups are applied once,
+ * while taking the snapshot.
+ *
+ * /chosen is not copied, as both we and the kernel change it.
+ * Any other setprop throws the snapshot away.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "quik.h"
+#include "prom.h"
+#include "devtree.h"
+#include "commands.h"
+#include "task.h"
+
+/* OF limits property names to 31 characters. */
+#define DT_PROP_NAME 32
+
+#define DT_HASH_SIZE 64
+#define DT_HASH(ph) ((((vaddr_t) (ph)) >> 3) & (DT_HASH_SIZE - 1))
+
+typedef struct dt_prop {
+   struct dt_prop *next;
+   length_t len;
+   char *value;
+   char name[0];
+} dt_prop_t;
+
+typedef struct dt_node {
+   phandle ph;
+   struct dt_node *parent;
+   struct dt_node *child;
+   struct dt_node *peer;
+   struct dt_node *hash_next;
+   dt_prop_t *props;
+
+   /* Properties aren't copied, ask OF. */
+   bool live;
+} dt_node_t;
+
+typedef enum {
+   DT_NONE,
+   DT_BUILDING,
+   DT_DONE,
+   DT_BAD,
+} dt_state_t;
+
+static struct {
+   dt_state_t state;
+   dt_node_t *root;
+
+   /* Last node added while building. */
+   dt_node_t *cur;
+   dt_node_t *hash[DT_HASH_SIZE];
+   unsigned nodes;
+   unsigned props;
+   length_t bytes;
+} dt;
+
+
+static dt_node_t *
+dt_find(phandle ph)
+{
+   dt_node_t *n;
+
+   for (n = dt.hash[DT_HASH(ph)]; n != NULL; n = n->hash_next) {
+      if (n->ph == ph) {
+         return n;
+      }
+   }
+
+   return NULL;
+}
+
+
+static bool
+dt_valid(phandle ph)
+{
+   return ph != 0 && ph != (phandle) -1;
+}
+
+
+/*
+ * Hidden nodes are skipped along with their subtrees.
+ */
+static phandle
+dt_of_peer(phandle ph)
+{
+   phandle hidden = prom_shim_hidden();
+
+   do {
+      ph = call_prom("peer", 1, 1, ph);
+   } while (dt_valid(ph) && ph == hidden);
+
+   return ph;
+}
+
+
+static phandle
+dt_of_child(phandle ph)
+{
+   phandle hidden = prom_shim_hidden();
+
+   ph = call_prom("child", 1, 1, ph);
+   if (dt_valid(ph) && ph == hidden) {
+      ph = dt_of_peer(ph);
+   }
+
+   return ph;
+}
+
+
+static quik_err_t
+dt_read_props(dt_node_t *n)
+{
+   int len;
+   char *prev = "";
+   char name[DT_PROP_NAME];
+   dt_prop_t *p;
+   dt_prop_t **tail = &n->props;
+
+   while ((int) call_prom("nextprop", 3, 1, n->ph, prev, name) == 1) {
+      len = (int) call_prom("getproplen", 2, 1, n->ph, name);
+      if (len < 0) {
+         len = 0;
+      }
+
+      p = malloc(sizeof(dt_prop_t) + strlen(name) + 1 + len);
+      if (p == NULL) {
+         return ERR_NO_MEM;
+      }
+
+      strcpy(p->name, name);
+      p->value = p->name + strlen(name) + 1;
+      p->len = len;
+      p->next = NULL;
+      if (len != 0) {
+         call_prom("getprop", 4, 1, n->ph, name, p->value, len);
+         prom_shim_fixup(n->ph, p->name, p->value, len);
+      }
+
+      *tail = p;
+      tail = &p->next;
+      prev = p->name;
+      dt.props++;
+      dt.bytes += len;
+   }
+
+   return ERR_NONE;
+}
+
+
+static quik_err_t
+dt_add(phandle ph,
+       dt_node_t *parent,
+       dt_node_t *prev)
+{
+   dt_node_t *n;
+   unsigned h = DT_HASH(ph);
+
+   n = malloc(sizeof(dt_node_t));
+   if (n == NULL) {
+      return ERR_NO_MEM;
+   }
+
+   memset(n, 0, sizeof(*n));
+   n->ph = ph;
+   n->parent = parent;
+   n->live = ph == prom_chosen;
+   n->hash_next = dt.hash[h];
+   dt.hash[h] = n;
+
+   if (prev != NULL) {
+      prev->peer = n;
+   } else if (parent != NULL) {
+      parent->child = n;
+   } else {
+      dt.root = n;
+   }
+
+   dt.cur = n;
+   dt.nodes++;
+
+   if (n->live) {
+      return ERR_NONE;
+   }
+
+   return dt_read_props(n);
+}
+
+
+/*
+ * Add the next node, in depth-first order.
+ */
+static quik_err_t
+dt_next(void)
+{
+   phandle ph;
+   dt_node_t *n;
+
+   if (dt.cur == NULL) {
+      ph = call_prom("peer", 1, 1, 0);
+      if (!dt_valid(ph)) {
+         return ERR_OF_INIT_NO_ROOT;
+      }
+
+      return dt_add(ph, NULL, NULL);
+   }
+
+   ph = dt_of_child(dt.cur->ph);
+   if (dt_valid(ph)) {
+      return dt_add(ph, dt.cur, NULL);
+   }
+
+   for (n = dt.cur; n != NULL; n = n->parent) {
+      ph = dt_of_peer(n->ph);
+      if (dt_valid(ph)) {
+         return dt_add(ph, n->parent, n);
+      }
+   }
+
+   dt.state = DT_DONE;
+   return ERR_NONE;
+}
+
+
+/*
+ * Adds a node to the snapshot. Returns false once there
+ * are no more to add.
+ */
+static bool
+devtree_step(void)
+{
+   if ((bi->flags & SHIM_OF) == 0 ||
+       !prom_shim_snapshot()) {
+      return false;
+   }
+
+   if (dt.state == DT_NONE) {
+      dt.state = DT_BUILDING;
+   }
+
+   if (dt.state == DT_BUILDING &&
+       dt_next() != ERR_NONE) {
+      dt.state = DT_BAD;
+   }
+
+   return dt.state == DT_BUILDING;
+}
+
+
+/*
+ * Only OF calls, so it also runs beside loads.
+ */
+static task_t devtree_task = { devtree_step, 0 };
+
+
+/*
+ * Start on the snapshot in the background.
+ */
+void
+devtree_start(void)
+{
+   task_start(&devtree_task);
+}
+
+
+/*
+ * Forth run through "interpret" can change the tree without
+ * a setprop the shim would see, so anything already copied
+ * is dropped and the snapshot starts over.
+ */
+void
+devtree_invalidate(void)
+{
+   unsigned h;
+   dt_node_t *n;
+   dt_prop_t *p;
+
+   if (dt.state == DT_NONE) {
+      return;
+   }
+
+   for (h = 0; h < DT_HASH_SIZE; h++) {
+      while (dt.hash[h] != NULL) {
+         n = dt.hash[h];
+         dt.hash[h] = n->hash_next;
+         while (n->props != NULL) {
+            p = n->props;
+            n->props = p->next;
+            free(p);
+         }
+
+         free(n);
+      }
+   }
+
+   memset(&dt, 0, sizeof(dt));
+   task_start(&devtree_task);
+}
+
+
+/*
+ * Finish the snapshot before handoff.
+ */
+quik_err_t
+devtree_snapshot(void)
+{
+   if ((bi->flags & SHIM_OF) == 0 ||
+       !prom_shim_snapshot()) {
+      return ERR_NONE;
+   }
+
+   task_stop(&devtree_task);
+   while (devtree_step())
+      ;
+
+   if (dt.state == DT_BAD) {
+      return ERR_NO_MEM;
+   }
+
+   if (bi->flags & DEBUG_BEFORE_BOOT) {
+      printk("Device tree snapshot: %u nodes, %u props, %u bytes\n",
+             dt.nodes, dt.props, dt.bytes);
+   }
+
+   return ERR_NONE;
+}
+
+
+/*
+ * Returns the snapshot node for ph, or NULL if the call
+ * has to go to OF.
+ */
+static dt_node_t *
+dt_shim_node(phandle ph)
+{
+   if (dt.state != DT_DONE) {
+      return NULL;
+   }
+
+   return dt_find(ph);
+}
+
+
+static bool
+dt_shim_walk(struct prom_args *args,
+             dt_node_t *result)
+{
+   args->args[1] = result == NULL ? 0 : result->ph;
+   return true;
+}
+
+
+bool
+devtree_shim_child(struct prom_args *args)
+{
+   dt_node_t *n = dt_shim_node(args->args[0]);
+
+   return n != NULL && dt_shim_walk(args, n->child);
+}
+
+
+bool
+devtree_shim_peer(struct prom_args *args)
+{
+   dt_node_t *n;
+
+   if (args->args[0] == 0 && dt.state == DT_DONE) {
+      return dt_shim_walk(args, dt.root);
+   }
+
+   n = dt_shim_node(args->args[0]);
+   return n != NULL && dt_shim_walk(args, n->peer);
+}
+
+
+bool
+devtree_shim_parent(struct prom_args *args)
+{
+   dt_node_t *n = dt_shim_node(args->args[0]);
+
+   return n != NULL && dt_shim_walk(args, n->parent);
+}
+
+
+static dt_prop_t *
+dt_find_prop(dt_node_t *n,
+             char *name)
+{
+   dt_prop_t *p;
+
+   for (p = n->props; p != NULL; p = p->next) {
+      if (strcmp(p->name, name) == 0) {
+         return p;
+      }
+   }
+
+   return NULL;
+}
+
+
+bool
+devtree_shim_getprop(struct prom_args *args)
+{
+   dt_prop_t *p;
+   dt_node_t *n = dt_shim_node(args->args[0]);
+   length_t size = (length_t) args->args[3];
+
+   if (n == NULL || n->live) {
+      return false;
+   }
+
+   p = dt_find_prop(n, args->args[1]);
+   if (p == NULL) {
+      args->args[4] = (void *) -1;
+      return true;
+   }
+
+   memcpy(args->args[2], p->value, MIN(size, p->len));
+   args->args[4] = (void *) p->len;
+   return true;
+}
+
+
+bool
+devtree_shim_getproplen(struct prom_args *args)
+{
+   dt_prop_t *p;
+   dt_node_t *n = dt_shim_node(args->args[0]);
+
+   if (n == NULL || n->live) {
+      return false;
+   }
+
+   p = dt_find_prop(n, args->args[1]);
+   args->args[2] = p == NULL ? (void *) -1 : (void *) p->len;
+   return true;
+}
+
+
+bool
+devtree_shim_nextprop(struct prom_args *args)
+{
+   dt_prop_t *p;
+   char *prev = args->args[1];
+   dt_node_t *n = dt_shim_node(args->args[0]);
+
+   if (n == NULL || n->live) {
+      return false;
+   }
+
+   if (prev == NULL || *prev == '\0') {
+      p = n->props;
+   } else {
+      p = dt_find_prop(n, prev);
+      if (p == NULL) {
+         args->args[3] = (void *) -1;
+         return true;
+      }
+
+      p = p->next;
+   }
+
+   if (p == NULL) {
+      args->args[3] = 0;
+      return true;
+   }
+
+   strcpy(args->args[2], p->name);
+   args->args[3] = (void *) 1;
+   return true;
+}
+
+
+/*
+ * Never handled, just drops the snapshot if it might
+ * no longer match.
+ */
+bool
+devtree_shim_setprop(struct prom_args *args)
+{
+   dt_node_t *n = dt_find(args->args[0]);
+
+   if (n == NULL || !n->live) {
+      dt.state = DT_BAD;
+   }
+
+   return false;
+}
@@ -0,0 +1,39 @@
+/*
+ * In-memory device tree snapshot, for the OF shim.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef QUIK_DEVTREE_H
+#define QUIK_DEVTREE_H
+
+#include "quik.h"
+#include "prom.h"
+
+void devtree_start(void);
+void devtree_invalidate(void);
+quik_err_t devtree_snapshot(void);
+
+bool devtree_shim_child(struct prom_args *args);
+bool devtree_shim_peer(struct prom_args *args);
+bool devtree_shim_parent(struct prom_args *args);
+bool devtree_shim_getprop(struct prom_args *args);
+bool devtree_shim_getproplen(struct prom_args *args);
+bool devtree_shim_nextprop(struct prom_args *args);
+bool devtree_shim_setprop(struct prom_args *args);
+
+#endif /* QUIK_DEVTREE_H */
@@ -20,6 +20,212 @@
 
 #include "quik.h"
 #include "disk.h"
+#include "commands.h"
+
+#ifndef CONFIG_TINY
+/*
+ * Per-device I/O statistics. Devices are tracked by name,
+ * so the numbers survive the device being closed and opened
+ * again by a later path lookup.
+ */
+#define DISK_STATS_MAX 8
+#define DISK_HIST_BUCKETS 16
+
+typedef struct {
+   char *device;
+   ihandle dev;
+   unsigned reads;
+   unsigned errors;
+   unsigned seeks;
+   uint32_t bytes;
+   uint32_t us;
+   offset_t next;
+
+   /*
+    * Bucket n counts reads taking less than 2^n us,
+    * the last one everything slower.
+    */
+   unsigned hist[DISK_HIST_BUCKETS];
+} disk_stat_t;
+
+static disk_stat_t disk_stats[DISK_STATS_MAX];
+static unsigned disk_stats_count;
+
+/*
+ * For the progress line.
+ */
+static uint32_t progress_start;
+static length_t progress_shown;
+
+
+static void
+disk_stat_open(char *device,
+               ihandle dev)
+{
+   unsigned i;
+   disk_stat_t *ds;
+
+   for (i = 0; i < disk_stats_count; i++) {
+      if (!strcmp(disk_stats[i].device, device)) {
+         disk_stats[i].dev = dev;
+         return;
+      }
+   }
+
+   if (disk_stats_count == DISK_STATS_MAX) {
+      return;
+   }
+
+   ds = &disk_stats[disk_stats_count];
+   ds->device = strdup(device);
+   if (ds->device == NULL) {
+      return;
+   }
+
+   ds->dev = dev;
+   disk_stats_count++;
+}
+
+
+static disk_stat_t *
+disk_stat_find(ihandle dev)
+{
+   unsigned i;
+
+   for (i = 0; i < disk_stats_count; i++) {
+      if (disk_stats[i].dev == dev) {
+         return &disk_stats[i];
+      }
+   }
+
+   return NULL;
+}
+
+
+static void
+disk_stat_read(ihandle dev,
+               offset_t offset,
+               length_t nbytes,
+               length_t nr,
+               uint32_t us)
+{
+   unsigned bucket = 0;
+   disk_stat_t *ds = disk_stat_find(dev);
+
+   if (ds == NULL) {
+      return;
+   }
+
+   if (offset != ds->next) {
+      ds->seeks++;
+   }
+
+   if (nr != nbytes) {
+      ds->errors++;
+   }
+
+   while (bucket < DISK_HIST_BUCKETS - 1 &&
+          us >= (1 << bucket)) {
+      bucket++;
+   }
+
+   ds->reads++;
+   ds->bytes += nr;
+   ds->us += us;
+   ds->next = offset + nbytes;
+   ds->hist[bucket]++;
+}
+
+
+static quik_err_t
+cmd_iostat(char *args)
+{
+   unsigned i;
+   unsigned b;
+   disk_stat_t *ds;
+
+   for (i = 0; i < disk_stats_count; i++) {
+      ds = &disk_stats[i];
+      printk("%s:\n", ds->device);
+      printk("   %u reads, %u errors, %u seeks, %u KB, %u bytes avg\n",
+             ds->reads, ds->errors, ds->seeks, ds->bytes >> 10,
+             ds->reads ? ds->bytes / ds->reads : 0);
+      printk("   %u ms total, %u KB/s\n", ds->us / 1000,
+             ds->us >= 1000 ? (ds->bytes >> 10) * 1000 / (ds->us / 1000) :
+             0);
+
+      for (b = 0; b < DISK_HIST_BUCKETS; b++) {
+         if (ds->hist[b] == 0) {
+            continue;
+         }
+
+         if (b == DISK_HIST_BUCKETS - 1) {
+            printk("   >= %u us: %u\n", 1 << (b - 1), ds->hist[b]);
+         } else {
+            printk("   < %u us: %u\n", 1 << b, ds->hist[b]);
+         }
+      }
+   }
+
+   return ERR_NONE;
+}
+
+COMMAND(iostat, cmd_iostat, "show disk I/O statistics");
+#endif /* CONFIG_TINY */
+
+
+/*
+ * Called as a file load goes along. Shows a progress line
+ * with the throughput when asked to, otherwise a spinner.
+ */
+void
+disk_progress(length_t done,
+              length_t total)
+{
+#ifndef CONFIG_TINY
+   uint32_t ms;
+   uint32_t kbs;
+#endif /* CONFIG_TINY */
+
+   /*
+    * Nothing to show for reads done while waiting at the prompt.
+    */
+   if (bi->flags & BACKGROUND_IO) {
+      return;
+   }
+
+#ifndef CONFIG_TINY
+   if ((bi->flags & SHOW_PROGRESS) == 0 ||
+       total < DISK_PROGRESS_MIN) {
+      spinner();
+      return;
+   }
+
+   if (done == 0) {
+      progress_start = prom_ticks();
+      progress_shown = 0;
+   }
+
+   if (done != total &&
+       done - progress_shown < DISK_PROGRESS_STEP) {
+      return;
+   }
+
+   progress_shown = done;
+   ms = prom_ticks_to_us(prom_ticks() - progress_start) / 1000;
+   kbs = ms ? (done >> 10) * 1000 / ms : 0;
+   printk("\r%u/%u KB, %u.%u MB/s ", done >> 10, total >> 10,
+          kbs >> 10, ((kbs & 1023) * 10) >> 10);
+   if (done == total) {
+      printk("\n");
+   }
+
+   prom_flush();
+#else
+   spinner();
+#endif /* CONFIG_TINY */
+}
+
 
 quik_err_t
 disk_open(char *device,
@@ -28,6 +234,11 @@ disk_open(char *device,
    quik_err_t err;
 
    err = prom_open(device, dev);
+#ifndef CONFIG_TINY
+   if (err == ERR_NONE) {
+      disk_stat_open(device, *dev);
+   }
+#endif /* CONFIG_TINY */
 
    return err;
 }
@@ -51,11 +262,18 @@ disk_read(ihandle dev,
           offset_t offset)
 {
    length_t nr;
+#ifndef CONFIG_TINY
+   uint32_t start;
+#endif /* CONFIG_TINY */
 
    if (nbytes == 0) {
       return 0;
    }
 
+#ifndef CONFIG_TINY
+   start = prom_ticks();
+#endif /* CONFIG_TINY */
+
    nr = (length_t) call_prom("seek", 3, 1, dev,
                              (unsigned int) (offset >> 32),
                              (unsigned int) (offset & 0xFFFFFFFF));
@@ -63,10 +281,15 @@ disk_read(ihandle dev,
    nr = (length_t) call_prom("read", 3, 1, dev,
                              buf, nbytes);
 
+#ifndef CONFIG_TINY
+   disk_stat_read(dev, offset, nbytes, nr,
+                  prom_ticks_to_us(prom_ticks() - start));
+#endif /* CONFIG_TINY */
+
    if (nr != nbytes) {
-      printk("Read error at offset %x%x (%u instead of %u)\n",
-             (uint32_t) (offset >> 32), (uint32_t) offset,
-             nr, nbytes);
+      printk_err("Read error at offset %x%x (%u instead of %u)\n",
+                 (uint32_t) (offset >> 32), (uint32_t) offset,
+                 nr, nbytes);
    }
 
    return nr;
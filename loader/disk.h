@@ -27,11 +27,20 @@
 #define SECTOR_SIZE 512
 #define SECTOR_BITS 9
 
+/*
+ * Only loads this big get a progress line, updated
+ * every DISK_PROGRESS_STEP bytes.
+ */
+#define DISK_PROGRESS_MIN  (256 * 1024)
+#define DISK_PROGRESS_STEP (128 * 1024)
+
 quik_err_t disk_open(char *device, ihandle *dev);
 void disk_close(ihandle dev);
 length_t disk_read(ihandle dev,
                    char *buf,
                    length_t nbytes,
                    offset_t offset);
+void disk_progress(length_t done,
+                   length_t total);
 
 #endif /* QUIK_PART_H */
@@ -22,6 +22,7 @@
 #include "quik.h"
 #include "elf.h"
 #include "prom.h"
+#include "timing.h"
 #include <layout.h>
 
 #define ADDRMASK 0x0fffffff
@@ -46,6 +47,11 @@ quik_err_t elf_parse(void *load_buf,
    offset_t off;
    vaddr_t entry;
    vaddr_t linked_base;
+   length_t exec_start;
+   length_t exec_end;
+   length_t p_offset;
+   length_t p_memsz;
+   length_t p_filesz;
 
    memset(image, 0, sizeof(*image));
 
@@ -71,16 +77,32 @@ quik_err_t elf_parse(void *load_buf,
     */
    off = 0;
    linked_base = 0;
-   p = (Elf32_Phdr *) (load_buf + e->e_phoff);
-   for (i = 0; i < e->e_phnum; ++i, ++p) {
-      if (p->p_type != PT_LOAD || p->p_offset == 0)
+   exec_start = ~0;
+   exec_end = 0;
+   p = (Elf32_Phdr *) (load_buf + be32_to_cpu(e->e_phoff));
+   for (i = 0; i < be16_to_cpu(e->e_phnum); ++i, ++p) {
+      p_offset = be32_to_cpu(p->p_offset);
+      p_memsz = be32_to_cpu(p->p_memsz);
+      p_filesz = be32_to_cpu(p->p_filesz);
+      if (be32_to_cpu(p->p_type) != PT_LOAD || p_offset == 0)
          continue;
       if (len == 0) {
-         off = p->p_offset;
-         len = p->p_memsz;
-         linked_base = p->p_vaddr & ADDRMASK;
+         off = p_offset;
+         len = p_memsz;
+         linked_base = be32_to_cpu(p->p_vaddr) & ADDRMASK;
       } else {
-         len = p->p_offset + p->p_memsz - off;
+         len = p_offset + p_memsz - off;
+      }
+
+      /*
+       * Only what's loaded from the file into executable
+       * segments needs flushing to the icache before boot.
+       */
+      if (be32_to_cpu(p->p_flags) & PF_X) {
+         exec_start = MIN(exec_start, p_offset - off);
+         if (p_offset + p_filesz - off > exec_end) {
+            exec_end = p_offset + p_filesz - off;
+         }
       }
    }
 
@@ -88,7 +110,7 @@ quik_err_t elf_parse(void *load_buf,
       return ERR_ELF_NOT_LOADABLE;
    }
 
-   entry = e->e_entry & ADDRMASK;
+   entry = be32_to_cpu(e->e_entry) & ADDRMASK;
    if (len + off > load_buf_len) {
       prom_ensure_claimed((vaddr_t *) (((vaddr_t) load_buf) + load_buf_len),
                          (len + off) - load_buf_len);
@@ -100,10 +122,59 @@ quik_err_t elf_parse(void *load_buf,
    image->text_len = len;
    image->entry = entry;
 
+   if (exec_end > exec_start) {
+      image->exec_offset = exec_start;
+      image->exec_len = MIN(exec_end, len) - exec_start;
+   } else {
+      image->exec_offset = 0;
+      image->exec_len = len;
+   }
+
    return ERR_NONE;
 }
 
 
+/*
+ * How far past load_buf the image elf_parse would find in it
+ * reaches once loaded, BSS included, or 0 if there isn't one.
+ */
+length_t
+elf_mem_len(void *load_buf,
+            length_t load_buf_len)
+{
+   unsigned i;
+   Elf32_Ehdr *e;
+   Elf32_Phdr *p;
+   length_t end;
+   length_t mem_len = 0;
+
+   e = (Elf32_Ehdr *) load_buf;
+   if (load_buf_len < sizeof(*e) ||
+       e->e_ident[EI_MAG0] != ELFMAG0 ||
+       e->e_ident[EI_MAG1] != ELFMAG1 ||
+       e->e_ident[EI_MAG2] != ELFMAG2 ||
+       e->e_ident[EI_MAG3] != ELFMAG3 ||
+       e->e_ident[EI_CLASS] != ELFCLASS32 ||
+       e->e_ident[EI_DATA] != ELFDATA2MSB ||
+       be32_to_cpu(e->e_phoff) + be16_to_cpu(e->e_phnum) *
+       sizeof(Elf32_Phdr) > load_buf_len) {
+      return 0;
+   }
+
+   p = (Elf32_Phdr *) (load_buf + be32_to_cpu(e->e_phoff));
+   for (i = 0; i < be16_to_cpu(e->e_phnum); ++i, ++p) {
+      if (be32_to_cpu(p->p_type) != PT_LOAD || p->p_offset == 0)
+         continue;
+      end = be32_to_cpu(p->p_offset) + be32_to_cpu(p->p_memsz);
+      if (end > mem_len) {
+         mem_len = end;
+      }
+   }
+
+   return mem_len;
+}
+
+
 /*
  * Do any necessary relocations.
  *
@@ -141,7 +212,7 @@ quik_err_t elf_relo(load_state_t *image)
       image->entry += image->linked_base;
    }
 
-   flush_cache(image->linked_base, image->text_len);
+   flush_cache(image->linked_base + image->exec_offset, image->exec_len);
    return ERR_NONE;
 }
 
@@ -177,7 +248,10 @@ quik_err_t elf_boot(load_state_t *image,
    }
 
    set_bootargs(params);
+   prom_export_log();
+   timing_export();
 
+   prom_flush();
    (* (void (*)()) start)(bi->initrd_base,
                           bi->initrd_len,
                           (bi->flags & SHIM_OF) ?
@@ -131,6 +131,7 @@ env_init(void)
       p = strchr(p, '/');
       if (p != 0) {
          bi->config_file = p;
+         bi->flags |= CONFIG_FILE_GIVEN;
       } else {
          bi->config_file = "/etc/quik.conf";
       }
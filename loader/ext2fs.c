@@ -25,12 +25,12 @@
  */
 
 #include "ext2fs.h"
+#include "pool.h"
+#include "disk.h"
+#include "task.h"
 
-/*
- * PowerPC only.
- */
-#define __le32_to_cpu(X) swab32(X)
-#define __le16_to_cpu(X) swab16(X)
+#define __le32_to_cpu(X) le32_to_cpu(X)
+#define __le16_to_cpu(X) le16_to_cpu(X)
 
 /* Magic value used to identify an ext2 filesystem.  */
 #define  EXT2_MAGIC     0xEF53
@@ -38,6 +38,9 @@
 /* Amount of indirect blocks in an inode.  */
 #define INDIRECT_BLOCKS    12
 
+/* Maximum length of a directory entry name.  */
+#define EXT2_NAME_LEN      255
+
 /* Maximum lenght of a pathname.  */
 #define EXT2_PATH_MAX      4096
 
@@ -59,6 +62,12 @@
 /* Bits used as offset in sector */
 #define DISK_SECTOR_BITS        9
 
+/* Lines !ls shows before waiting for a key, with LS_PAGE.  */
+#define LS_PAGE_LINES      20
+
+/* Largest single read of a pinned file, a multiple of the sector size.  */
+#define PIN_READ_CHUNK     (512 * 1024)
+
 /* Log2 size of ext2 block in 512 blocks.  */
 #define LOG2_EXT2_BLOCK_SIZE(data) (__le32_to_cpu(data->sblock.log2_block_size) + 1)
 
@@ -165,6 +174,12 @@ struct ext2fs_node {
    int inode_read;
 };
 
+/* Directory entry scratch space used while iterating.  */
+struct ext2fs_dirent_buf {
+   struct ext2_dirent dirent;
+   char name[EXT2_NAME_LEN + 1];
+};
+
 /* Information about a "mounted" ext2 filesystem.  */
 struct ext2_data {
    part_t *part;
@@ -176,6 +191,22 @@ struct ext2_data {
 
 typedef struct ext2fs_node *ext2fs_node_t;
 
+/* A directory entry being listed.  */
+typedef struct {
+   uint32_t ino;
+   uint32_t size;
+   int type;
+   char *name;
+} ls_entry_t;
+
+/* Everything ext2fs_ls collects.  */
+typedef struct {
+   ls_entry_t *entries;
+   unsigned count;
+   char *names;
+   char *block;
+} ls_t;
+
 struct ext2_data *ext2fs_root = NULL;
 ext2fs_node_t ext2fs_file = NULL;
 int symlinknest = 0;
@@ -186,6 +217,8 @@ uint32_t *indir2_block = NULL;
 int indir2_size = 0;
 int indir2_blkno = -1;
 static unsigned int inode_size;
+static POOL(node_pool, struct ext2fs_node, 16);
+static POOL(dirent_pool, struct ext2fs_dirent_buf, 2);
 
 
 static quik_err_t
@@ -264,7 +297,7 @@ void ext2fs_free_node(ext2fs_node_t node,
                       ext2fs_node_t currroot)
 {
    if ((node != &ext2fs_root->diropen) && (node != currroot)) {
-      free(node);
+      pool_free(&node_pool, node);
    }
 }
 
@@ -432,6 +465,7 @@ ext2fs_read_file(ext2fs_node_t node,
 {
    unsigned i;
    unsigned blockcnt;
+   length_t done = 0;
    quik_err_t err;
    int log2blocksize = LOG2_EXT2_BLOCK_SIZE(node->data);
    int blocksize = 1 << (log2blocksize + DISK_SECTOR_BITS);
@@ -449,7 +483,12 @@ ext2fs_read_file(ext2fs_node_t node,
       unsigned blockoff = pos % blocksize;
       length_t blockend = blocksize;
 
-      spinner(5);
+      err = task_yield();
+      if (err != ERR_NONE) {
+         return err;
+      }
+
+      disk_progress(done, len);
 
       int skipfirst = 0;
 
@@ -485,12 +524,14 @@ ext2fs_read_file(ext2fs_node_t node,
             return err;
          }
       } else {
-         memset(buf, 0, blocksize - skipfirst);
+         memset(buf, 0, blockend);
       }
 
       buf += blocksize - skipfirst;
+      done += blockend;
    }
 
+   disk_progress(done, len);
    return ERR_NONE;
 }
 
@@ -504,6 +545,7 @@ ext2fs_iterate_dir(ext2fs_node_t dir,
    unsigned int fpos = 0;
    quik_err_t err;
    struct ext2fs_node *diro = (struct ext2fs_node *) dir;
+   struct ext2fs_dirent_buf *d;
 
 #ifdef DEBUG
    if (name != NULL)
@@ -517,59 +559,66 @@ ext2fs_iterate_dir(ext2fs_node_t dir,
       }
    }
 
+   d = pool_alloc(&dirent_pool);
+   if (d == NULL) {
+      return ERR_NO_MEM;
+   }
+
    /* Search the file.  */
+   err = ERR_FS_NOT_FOUND;
    while (fpos < __le32_to_cpu(diro->inode.size)) {
-      struct ext2_dirent dirent;
+      char *filename = d->name;
 
       err = ext2fs_read_file(diro, fpos,
                              sizeof (struct ext2_dirent),
-                             (char *) &dirent);
+                             (char *) &d->dirent);
       if (err != ERR_NONE) {
-         return err;
+         break;
       }
 
-      if (dirent.namelen != 0) {
-         char filename[dirent.namelen + 1];
+      err = ERR_FS_NOT_FOUND;
+      if (d->dirent.namelen != 0) {
          ext2fs_node_t fdiro;
          int type = FILETYPE_UNKNOWN;
 
          err = ext2fs_read_file(diro,
                                 fpos + sizeof (struct ext2_dirent),
-                                dirent.namelen, filename);
+                                d->dirent.namelen, filename);
          if (err != ERR_NONE) {
-            return err;
+            break;
          }
 
-         fdiro = malloc(sizeof (struct ext2fs_node));
+         fdiro = pool_alloc(&node_pool);
          if (!fdiro) {
-            return ERR_NO_MEM;
+            err = ERR_NO_MEM;
+            break;
          }
 
          fdiro->data = diro->data;
-         fdiro->ino = __le32_to_cpu(dirent.inode);
+         fdiro->ino = __le32_to_cpu(d->dirent.inode);
 
-         filename[dirent.namelen] = '\0';
+         filename[d->dirent.namelen] = '\0';
 
-         if (dirent.filetype != FILETYPE_UNKNOWN) {
+         if (d->dirent.filetype != FILETYPE_UNKNOWN) {
             fdiro->inode_read = 0;
 
-            if (dirent.filetype == FILETYPE_DIRECTORY) {
+            if (d->dirent.filetype == FILETYPE_DIRECTORY) {
                type = FILETYPE_DIRECTORY;
-            } else if (dirent.filetype ==
+            } else if (d->dirent.filetype ==
                        FILETYPE_SYMLINK) {
                type = FILETYPE_SYMLINK;
-            } else if (dirent.filetype == FILETYPE_REG) {
+            } else if (d->dirent.filetype == FILETYPE_REG) {
                type = FILETYPE_REG;
             }
          } else {
 
             /* The filetype can not be read from the dirent, get it from inode */
             err = ext2fs_read_inode(diro->data,
-                                    __le32_to_cpu(dirent.inode),
+                                    __le32_to_cpu(d->dirent.inode),
                                     &fdiro->inode);
             if (err != ERR_NONE) {
-               free(fdiro);
-               return err;
+               pool_free(&node_pool, fdiro);
+               break;
             }
 
             fdiro->inode_read = 1;
@@ -591,53 +640,22 @@ ext2fs_iterate_dir(ext2fs_node_t dir,
 #ifdef DEBUG
          printk ("iterate >%s<\n", filename);
 #endif /* of DEBUG */
-         if ((name != NULL) && (fnode != NULL)
-             && (ftype != NULL)) {
-            if (strcmp (filename, name) == 0) {
-               *ftype = type;
-               *fnode = fdiro;
-               return ERR_NONE;
-            }
-         } else {
-            if (fdiro->inode_read == 0) {
-               err = ext2fs_read_inode(diro->data,
-                                       __le32_to_cpu(dirent.inode),
-                                       &fdiro->inode);
-               if (err != ERR_NONE) {
-                  free(fdiro);
-                  return err;
-               }
-
-               fdiro->inode_read = 1;
-            }
-
-            switch (type) {
-            case FILETYPE_DIRECTORY:
-               printk ("<DIR> ");
-               break;
-            case FILETYPE_SYMLINK:
-               printk ("<SYM> ");
-               break;
-            case FILETYPE_REG:
-               printk ("      ");
-               break;
-            default:
-               printk ("< ? > ");
-               break;
-            }
-
-            printk("%d %s\n",
-                   __le32_to_cpu(fdiro->inode.size),
-                   filename);
+         if (strcmp (filename, name) == 0) {
+            *ftype = type;
+            *fnode = fdiro;
+            err = ERR_NONE;
+            break;
          }
 
-         free(fdiro);
+         pool_free(&node_pool, fdiro);
+         err = ERR_FS_NOT_FOUND;
       }
 
-      fpos += __le16_to_cpu(dirent.direntlen);
+      fpos += __le16_to_cpu(d->dirent.direntlen);
    }
 
-   return ERR_FS_NOT_FOUND;
+   pool_free(&dirent_pool, d);
+   return err;
 }
 
 
@@ -825,11 +843,262 @@ ext2fs_find_file(const char *path,
 }
 
 
+static int
+ls_by_ino(ls_entry_t *a,
+          ls_entry_t *b)
+{
+   return a->ino < b->ino ? -1 : a->ino > b->ino;
+}
+
+
+static int
+ls_by_name(ls_entry_t *a,
+           ls_entry_t *b)
+{
+   return strcmp(a->name, b->name);
+}
+
+
+/*
+ * Shell sort, as directories like /lib/modules are big
+ * enough for insertion sort to hurt.
+ */
+static void
+ls_sort(ls_entry_t **v,
+        unsigned n,
+        int (*cmp)(ls_entry_t *, ls_entry_t *))
+{
+   unsigned gap = 1;
+   unsigned i;
+   unsigned j;
+   ls_entry_t *e;
+
+   while (gap < n / 3) {
+      gap = gap * 3 + 1;
+   }
+
+   for (; gap > 0; gap /= 3) {
+      for (i = gap; i < n; i++) {
+         e = v[i];
+         for (j = i; j >= gap && cmp(v[j - gap], e) > 0; j -= gap) {
+            v[j] = v[j - gap];
+         }
+
+         v[j] = e;
+      }
+   }
+}
+
+
+/*
+ * Collects the entries of dir a directory block at a time. Names
+ * go to ls->names, which is as big as the directory, as an entry
+ * is always longer than its name.
+ */
+static quik_err_t
+ls_read_dir(ext2fs_node_t dir,
+            ls_t *ls)
+{
+   quik_err_t err;
+   unsigned max = 0;
+   length_t pos;
+   length_t off;
+   length_t len;
+   length_t rec;
+   char *names;
+   ls_entry_t *e;
+   struct ext2_dirent *de;
+   length_t size = __le32_to_cpu(dir->inode.size);
+   length_t blocksize = EXT2_BLOCK_SIZE(dir->data);
+
+   ls->names = names = malloc(size);
+   if (names == NULL) {
+      return ERR_NO_MEM;
+   }
+
+   for (pos = 0; pos < size; pos += blocksize) {
+      len = size - pos < blocksize ? size - pos : blocksize;
+      err = ext2fs_read_file(dir, pos, len, ls->block);
+      if (err != ERR_NONE) {
+         return err;
+      }
+
+      for (off = 0; off + sizeof(*de) <= len; off += rec) {
+         de = (struct ext2_dirent *) (ls->block + off);
+         rec = __le16_to_cpu(de->direntlen);
+         if (rec < sizeof(*de) + de->namelen || off + rec > len) {
+            return ERR_FS_CORRUPT;
+         }
+
+         /* Deleted.  */
+         if (de->inode == 0 || de->namelen == 0) {
+            continue;
+         }
+
+         if (ls->count == max) {
+            max = max ? max * 2 : 32;
+            e = realloc(ls->entries, max * sizeof(ls_entry_t));
+            if (e == NULL) {
+               return ERR_NO_MEM;
+            }
+
+            ls->entries = e;
+         }
+
+         e = &ls->entries[ls->count++];
+         e->ino = __le32_to_cpu(de->inode);
+         e->size = 0;
+         e->type = FILETYPE_UNKNOWN;
+         if (de->filetype == FILETYPE_DIRECTORY ||
+             de->filetype == FILETYPE_SYMLINK ||
+             de->filetype == FILETYPE_REG) {
+            e->type = de->filetype;
+         }
+
+         e->name = names;
+         memcpy(names, de + 1, de->namelen);
+         names[de->namelen] = '\0';
+         names += de->namelen + 1;
+      }
+   }
+
+   return ERR_NONE;
+}
+
+
+/*
+ * Fills in sizes, and types the directory didn't have, for
+ * entries sorted by inode number. That puts the entries sharing
+ * an inode table block next to each other, so that each block,
+ * and each group descriptor, is read just once.
+ */
+static quik_err_t
+ls_read_inodes(struct ext2_data *data,
+               ls_t *ls,
+               ls_entry_t **v)
+{
+   unsigned i;
+   unsigned ino;
+   unsigned blkno;
+   unsigned cur = 0;
+   unsigned group = 0;
+   quik_err_t err;
+   ls_entry_t *e;
+   struct ext2_inode *inode;
+   struct ext2_block_group blkgrp;
+   struct ext2_sblock *sblock = &data->sblock;
+   unsigned ipg = __le32_to_cpu(sblock->inodes_per_group);
+   int inodes_per_block = EXT2_BLOCK_SIZE(data) / inode_size;
+
+   for (i = 0; i < ls->count; i++) {
+      e = v[i];
+      if (e->ino > __le32_to_cpu(sblock->total_inodes)) {
+         return ERR_FS_CORRUPT;
+      }
+
+      /* It is easier to calculate if the first inode is 0.  */
+      ino = e->ino - 1;
+      if (cur == 0 || ino / ipg != group) {
+         group = ino / ipg;
+         err = ext2fs_blockgroup(data, group, &blkgrp);
+         if (err != ERR_NONE) {
+            return err;
+         }
+
+         cur = 0;
+      }
+
+      blkno = __le32_to_cpu(blkgrp.inode_table_id) +
+         (ino % ipg) / inodes_per_block;
+      if (blkno != cur) {
+         err = task_yield();
+         if (err != ERR_NONE) {
+            return err;
+         }
+
+         err = part_read(data->part, blkno << LOG2_EXT2_BLOCK_SIZE(data),
+                         0, EXT2_BLOCK_SIZE(data), ls->block);
+         if (err != ERR_NONE) {
+            return err;
+         }
+
+         cur = blkno;
+      }
+
+      inode = (struct ext2_inode *)
+         (ls->block + (ino % inodes_per_block) * inode_size);
+      e->size = __le32_to_cpu(inode->size);
+      if (e->type == FILETYPE_UNKNOWN) {
+         switch (__le16_to_cpu(inode->mode) & FILETYPE_INO_MASK) {
+         case FILETYPE_INO_DIRECTORY:
+            e->type = FILETYPE_DIRECTORY;
+            break;
+         case FILETYPE_INO_SYMLINK:
+            e->type = FILETYPE_SYMLINK;
+            break;
+         case FILETYPE_INO_REG:
+            e->type = FILETYPE_REG;
+            break;
+         }
+      }
+   }
+
+   return ERR_NONE;
+}
+
+
+/*
+ * Returns false if the listing should stop.
+ */
+static bool
+ls_print(ls_entry_t *e,
+         unsigned n,
+         unsigned flags)
+{
+   key_t c;
+
+   if ((flags & LS_PAGE) && n != 0 && n % LS_PAGE_LINES == 0) {
+      printk("-- more --");
+      c = getchar();
+      printk("\r          \r");
+      if (c == 'q' || c == KEY_ESC || c == KEY_CTRL_C) {
+         return false;
+      }
+   }
+
+   switch (e->type) {
+   case FILETYPE_DIRECTORY:
+      printk ("<DIR> ");
+      break;
+   case FILETYPE_SYMLINK:
+      printk ("<SYM> ");
+      break;
+   case FILETYPE_REG:
+      printk ("      ");
+      break;
+   default:
+      printk ("< ? > ");
+      break;
+   }
+
+   printk("%d %s\n", e->size, e->name);
+   return true;
+}
+
+
+/*
+ * Lists dirname in directory order, or by name with LS_SORT,
+ * a screenful at a time with LS_PAGE.
+ */
 quik_err_t
-ext2fs_ls(char *dirname)
+ext2fs_ls(char *dirname,
+          unsigned flags)
 {
+   unsigned i;
    ext2fs_node_t dirnode;
    quik_err_t err;
+   ls_entry_t **v = NULL;
+   ls_t ls = { 0 };
 
    if (ext2fs_root == NULL) {
       return ERR_FS_NOT_FOUND;
@@ -841,9 +1110,79 @@ ext2fs_ls(char *dirname)
       return err;
    }
 
-   ext2fs_iterate_dir(dirnode, NULL, NULL, NULL);
+   if (!dirnode->inode_read) {
+      err = ext2fs_read_inode(dirnode->data, dirnode->ino,
+                              &dirnode->inode);
+      if (err != ERR_NONE) {
+         goto out;
+      }
+
+      dirnode->inode_read = 1;
+   }
+
+   ls.block = malloc(EXT2_BLOCK_SIZE(dirnode->data));
+   if (ls.block == NULL) {
+      err = ERR_NO_MEM;
+      goto out;
+   }
+
+   err = ls_read_dir(dirnode, &ls);
+   if (err != ERR_NONE || ls.count == 0) {
+      goto out;
+   }
+
+   v = malloc(ls.count * sizeof(ls_entry_t *));
+   if (v == NULL) {
+      err = ERR_NO_MEM;
+      goto out;
+   }
+
+   for (i = 0; i < ls.count; i++) {
+      v[i] = &ls.entries[i];
+   }
+
+   ls_sort(v, ls.count, ls_by_ino);
+   err = ls_read_inodes(dirnode->data, &ls, v);
+   if (err != ERR_NONE) {
+      goto out;
+   }
+
+   if (flags & LS_SORT) {
+      ls_sort(v, ls.count, ls_by_name);
+   } else {
+      for (i = 0; i < ls.count; i++) {
+         v[i] = &ls.entries[i];
+      }
+   }
+
+   for (i = 0; i < ls.count; i++) {
+      if (!ls_print(v[i], i, flags)) {
+         break;
+      }
+   }
+
+out:
+   free(v);
+   free(ls.entries);
+   free(ls.names);
+   free(ls.block);
    ext2fs_free_node(dirnode, &ext2fs_root->diropen);
-   return ERR_NONE;
+   return err;
+}
+
+
+/*
+ * Each open replaces the open file, so its node goes back
+ * to the pool first.
+ */
+static void
+ext2fs_close_file(void)
+{
+   if (ext2fs_file != NULL && ext2fs_root != NULL) {
+      ext2fs_free_node(ext2fs_file, &ext2fs_root->diropen);
+   }
+
+   ext2fs_file = NULL;
 }
 
 
@@ -859,7 +1198,7 @@ ext2fs_open(char *filename,
       return ERR_FS_NOT_FOUND;
    }
 
-   ext2fs_file = NULL;
+   ext2fs_close_file();
    err = ext2fs_find_file(filename, &ext2fs_root->diropen, &fdiro,
                           FILETYPE_REG);
    if (err != ERR_NONE) {
@@ -885,14 +1224,179 @@ fail:
 }
 
 
+/*
+ * Open a file the installer pinned, by inode number instead of by
+ * path, if the file system and the inode still match the record.
+ */
+quik_err_t
+ext2fs_open_pinned(bootconf_file_t *pin,
+                   length_t *out_len)
+{
+   ext2fs_node_t node;
+   quik_err_t err;
+   uint32_t ino = be32_to_cpu(pin->ino);
+
+   if (ext2fs_root == NULL) {
+      return ERR_FS_NOT_FOUND;
+   }
+
+   if (memcmp(ext2fs_root->sblock.unique_id, pin->uuid,
+              sizeof(pin->uuid)) != 0 ||
+       ino == 0 ||
+       ino > __le32_to_cpu(ext2fs_root->sblock.total_inodes)) {
+      return ERR_FS_PIN_STALE;
+   }
+
+   ext2fs_close_file();
+   node = pool_alloc(&node_pool);
+   if (node == NULL) {
+      return ERR_NO_MEM;
+   }
+
+   node->data = ext2fs_root;
+   node->ino = ino;
+   node->inode_read = 1;
+   err = ext2fs_read_inode(ext2fs_root, ino, &node->inode);
+   if (err != ERR_NONE) {
+      goto fail;
+   }
+
+   /*
+    * 'version' is i_generation, bumped whenever the inode
+    * is reused.
+    */
+   if ((__le16_to_cpu(node->inode.mode) & FILETYPE_INO_MASK) !=
+       FILETYPE_INO_REG ||
+       node->inode.nlinks == 0 ||
+       node->inode.dtime != 0 ||
+       __le32_to_cpu(node->inode.version) != be32_to_cpu(pin->generation) ||
+       __le32_to_cpu(node->inode.mtime) != be32_to_cpu(pin->mtime) ||
+       __le32_to_cpu(node->inode.ctime) != be32_to_cpu(pin->ctime) ||
+       __le32_to_cpu(node->inode.size) != be32_to_cpu(pin->size) ||
+       bootconf_sum((unsigned char *) &node->inode.b,
+                    sizeof(node->inode.b)) != be32_to_cpu(pin->block_sum)) {
+      err = ERR_FS_PIN_STALE;
+      goto fail;
+   }
+
+   ext2fs_file = node;
+   *out_len = __le32_to_cpu(node->inode.size);
+   return ERR_NONE;
+
+fail:
+   pool_free(&node_pool, node);
+   return err;
+}
+
+
+/*
+ * Read len bytes at pos of a file opened with ext2fs_open_pinned,
+ * an extent per device read where possible.
+ */
+quik_err_t
+ext2fs_read_pinned(bootconf_file_t *pin,
+                   bootconf_extent_t *extents,
+                   char *buf,
+                   length_t pos,
+                   length_t len)
+{
+   unsigned i;
+   quik_err_t err;
+   length_t at = pos;
+   length_t end = pos + len;
+   length_t chunk;
+   length_t x_start;
+   length_t x_end;
+
+   if (ext2fs_root == NULL) {
+      return ERR_FS_NOT_FOUND;
+   }
+
+   for (i = 0; i < be32_to_cpu(pin->extents) && at < end; i++) {
+      x_start = be32_to_cpu(extents[i].offset);
+      x_end = x_start + be32_to_cpu(extents[i].len);
+      if (x_end <= at) {
+         continue;
+      }
+
+      /* Holes read as zeroes. */
+      if (x_start > at) {
+         chunk = (x_start < end ? x_start : end) - at;
+         memset(buf + at - pos, 0, chunk);
+         at += chunk;
+      }
+
+      /*
+       * Large extents are split up only so that progress
+       * can be shown, and the load aborted.
+       */
+      while (at < x_end && at < end) {
+         err = task_yield();
+         if (err != ERR_NONE) {
+            return err;
+         }
+
+         disk_progress(at - pos, len);
+         chunk = (x_end < end ? x_end : end) - at;
+         if (chunk > PIN_READ_CHUNK) {
+            chunk = PIN_READ_CHUNK;
+         }
+
+         err = part_read(ext2fs_root->part,
+                         be32_to_cpu(extents[i].sector) +
+                         ((at - x_start) >> DISK_SECTOR_BITS),
+                         (at - x_start) & ((1 << DISK_SECTOR_BITS) - 1),
+                         chunk, buf + at - pos);
+         if (err != ERR_NONE) {
+            return err;
+         }
+
+         at += chunk;
+      }
+   }
+
+   memset(buf + at - pos, 0, end - at);
+   disk_progress(len, len);
+   return ERR_NONE;
+}
+
+
+/*
+ * Identify the currently open file, to tell if a
+ * copy read earlier is still current.
+ */
 void
-ext2fs_close(void)
+ext2fs_file_id(uint32_t *ino,
+               uint32_t *mtime)
 {
-   if ((ext2fs_file != NULL) && (ext2fs_root != NULL)) {
-      ext2fs_free_node(ext2fs_file, &ext2fs_root->diropen);
-      ext2fs_file = NULL;
+   *ino = 0;
+   *mtime = 0;
+
+   if (ext2fs_file != NULL) {
+      *ino = ext2fs_file->ino;
+      *mtime = __le32_to_cpu(ext2fs_file->inode.mtime);
    }
+}
 
+
+/*
+ * UUID of the mounted file system, to pick out its pins.
+ */
+uint8_t *
+ext2fs_uuid(void)
+{
+   if (ext2fs_root == NULL) {
+      return NULL;
+   }
+
+   return (uint8_t *) ext2fs_root->sblock.unique_id;
+}
+
+
+void
+ext2fs_close(void)
+{
+   ext2fs_close_file();
    if (ext2fs_root != NULL) {
       free(ext2fs_root);
       ext2fs_root = NULL;
@@ -916,7 +1420,8 @@ ext2fs_close(void)
 
 quik_err_t
 ext2fs_read(char *buf,
-            unsigned len)
+            length_t pos,
+            length_t len)
 {
    quik_err_t err;
 
@@ -928,7 +1433,7 @@ ext2fs_read(char *buf,
       return ERR_FS_NOT_FOUND;
    }
 
-   err = ext2fs_read_file(ext2fs_file, 0, len, buf);
+   err = ext2fs_read_file(ext2fs_file, pos, len, buf);
    return err;
 }
 
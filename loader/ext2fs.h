@@ -31,9 +31,20 @@
 #include "part.h"
 
 void ext2fs_close(void);
-quik_err_t ext2fs_read(char *buf, length_t len);
+quik_err_t ext2fs_read(char *buf, length_t pos, length_t len);
 quik_err_t ext2fs_mount(part_t *part);
 quik_err_t ext2fs_open(char *filename, length_t *out_len);
-quik_err_t ext2fs_ls(char *dir);
+quik_err_t ext2fs_open_pinned(bootconf_file_t *pin, length_t *out_len);
+quik_err_t ext2fs_read_pinned(bootconf_file_t *pin,
+                              bootconf_extent_t *extents,
+                              char *buf,
+                              length_t pos,
+                              length_t len);
+void ext2fs_file_id(uint32_t *ino, uint32_t *mtime);
+uint8_t *ext2fs_uuid(void);
+/* ext2fs_ls flags.  */
+#define LS_SORT (1 << 0)
+#define LS_PAGE (1 << 1)
+quik_err_t ext2fs_ls(char *dir, unsigned flags);
 
 #endif /* QUIK_EXT2FS_H */
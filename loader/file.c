@@ -24,8 +24,28 @@
 #include "file.h"
 #include "ext2fs.h"
 #include "commands.h"
+#include "pool.h"
+
+/*
+ * Most path specs fit, longer ones are malloc-ed.
+ */
+#define PATH_POOL_SPEC 128
+
+typedef struct {
+   path_t path;
+   char spec[PATH_POOL_SPEC];
+} path_buf_t;
 
 static part_t part;
+static POOL(path_pool, path_buf_t, 8);
+
+/*
+ * Set while the open file is one the installer pinned. A pin
+ * that didn't check out is remembered to complain just once.
+ */
+static bootconf_file_t *pinned;
+static bootconf_extent_t *pinned_extents;
+static bootconf_file_t *pin_failed;
 
 static quik_err_t
 open_ext2(char *device,
@@ -59,23 +79,85 @@ open_ext2(char *device,
 }
 
 
-quik_err_t
-file_len(path_t *path,
-         length_t *len)
+/*
+ * Opens path directly through its pin if it has a usable one,
+ * and by walking the directories otherwise.
+ */
+static quik_err_t
+file_open(path_t *path,
+          length_t *len)
 {
    quik_err_t err;
-   *len = 0;
 
    err = open_ext2(path->device, path->part, &part);
    if (err != ERR_NONE) {
       return err;
    }
 
-   err = ext2fs_open(path->path, len);
+   /*
+    * Only pins for the file system just mounted, as the same
+    * path can be pinned on more than one partition.
+    */
+   pinned = cfg_pinned(path->path, ext2fs_uuid(), &pinned_extents);
+   if (pinned != NULL && pinned != pin_failed) {
+      err = ext2fs_open_pinned(pinned, len);
+      if (err == ERR_NONE) {
+         return ERR_NONE;
+      }
+
+      printk("Not using pinned '%P': %r\n", path, err);
+      pin_failed = pinned;
+   }
+
+   pinned = NULL;
+   return ext2fs_open(path->path, len);
+}
+
+
+/*
+ * Whether the file info was fetched for is still the open one,
+ * on the partition path names. Goes by the inode rather than by
+ * path, as paths come and go (and some live on the stack).
+ */
+static bool
+file_is_open(path_t *path,
+             file_info_t *info)
+{
+   uint32_t ino;
+   uint32_t mtime;
+
+   if ((part.flags & PART_MOUNTED) == 0 ||
+       part.partno != path->part ||
+       strcmp(part.devname, path->device)) {
+      return false;
+   }
+
+   ext2fs_file_id(&ino, &mtime);
+   return ino != 0 && ino == info->ino && mtime == info->mtime;
+}
+
+
+quik_err_t
+file_len(path_t *path,
+         length_t *len)
+{
+   *len = 0;
+   return file_open(path, len);
+}
+
+
+quik_err_t
+file_info(path_t *path,
+          file_info_t *info)
+{
+   quik_err_t err;
+
+   err = file_len(path, &info->len);
    if (err != ERR_NONE) {
       return err;
    }
 
+   ext2fs_file_id(&info->ino, &info->mtime);
    return ERR_NONE;
 }
 
@@ -87,22 +169,54 @@ file_load(path_t *path,
    length_t size;
    quik_err_t err;
 
-   err = open_ext2(path->device, path->part, &part);
+   err = file_open(path, &size);
    if (err != ERR_NONE) {
       return err;
    }
 
-   err = ext2fs_open(path->path, &size);
-   if (err != ERR_NONE) {
-      return err;
+   if (pinned != NULL) {
+      return ext2fs_read_pinned(pinned, pinned_extents, buffer, 0, size);
    }
 
-   return ext2fs_read(buffer, size);
+   return ext2fs_read(buffer, 0, size);
 }
 
 
+/*
+ * Read len bytes at offset into buffer. Meant for reading a file
+ * a piece at a time, so path is only opened again if some other
+ * file was opened since info was fetched by file_info. The caller
+ * checks offset and len against the file's length.
+ */
 quik_err_t
-file_ls(path_t *path)
+file_read(path_t *path,
+          file_info_t *info,
+          length_t offset,
+          length_t len,
+          void *buffer)
+{
+   length_t size;
+   quik_err_t err;
+
+   if (!file_is_open(path, info)) {
+      err = file_open(path, &size);
+      if (err != ERR_NONE) {
+         return err;
+      }
+   }
+
+   if (pinned != NULL) {
+      return ext2fs_read_pinned(pinned, pinned_extents, buffer,
+                                offset, len);
+   }
+
+   return ext2fs_read(buffer, offset, len);
+}
+
+
+quik_err_t
+file_ls(path_t *path,
+        unsigned flags)
 {
    quik_err_t err;
 
@@ -111,7 +225,7 @@ file_ls(path_t *path)
       return err;
    }
 
-   return ext2fs_ls(path->path);
+   return ext2fs_ls(path->path, flags);
 }
 
 
@@ -126,11 +240,18 @@ file_path(char *pathspec,
    unsigned slen = strlen(pathspec) + 1;
    path_t *p;
 
-   p = (path_t *) malloc(slen + sizeof(path_t));
+   if (slen <= PATH_POOL_SPEC) {
+      p = pool_alloc(&path_pool);
+   } else {
+      p = malloc(slen + sizeof(path_t));
+   }
+
    if (p == NULL) {
       return ERR_NO_MEM;
    }
 
+   p->pooled = slen <= PATH_POOL_SPEC;
+
    memcpy((void *) (p + 1), pathspec, slen);
    pathspec = (char *) (p + 1);
    pathspec = chomp(pathspec);
@@ -139,6 +260,7 @@ file_path(char *pathspec,
    if (!p->path) {
       err = env_dev_is_valid(default_dev);
       if (err != ERR_NONE) {
+         file_path_free(p);
          return err;
       }
 
@@ -194,11 +316,26 @@ file_path(char *pathspec,
    return ERR_NONE;
 
 bad_path:
-   free(p);
+   file_path_free(p);
    return ERR_FS_PATH;
 }
 
 
+void
+file_path_free(path_t *path)
+{
+   if (path == NULL) {
+      return;
+   }
+
+   if (path->pooled) {
+      pool_free(&path_pool, path);
+   } else {
+      free(path);
+   }
+}
+
+
 quik_err_t
 file_cmd_dev(char *p)
 {
@@ -253,14 +390,14 @@ file_cmd_cat(char *p)
 
    err = file_len(path, &len);
    if (err != ERR_NONE) {
-      free(path);
+      file_path_free(path);
       return err;
    }
 
-   message = malloc(len);
+   message = malloc(len + 1);
    if (message == NULL) {
-      free(path);
-      return err;
+      file_path_free(path);
+      return ERR_NO_MEM;
    }
    err = file_load(path, message);
    if (err == ERR_NONE) {
@@ -269,7 +406,7 @@ file_cmd_cat(char *p)
    }
 
    free(message);
-   free(path);
+   file_path_free(path);
    return err;
 }
 
@@ -281,12 +418,38 @@ file_cmd_ls(char *args)
 {
    path_t *path;
    quik_err_t err;
+   char *word;
+   char *rest;
+   unsigned flags = 0;
+
+   /*
+    * -s sorts by name, -p pauses after every screenful.
+    */
+   for (;;) {
+      word = args;
+      word_split(&word, &rest);
+      if (word == NULL || word[0] != '-') {
+         break;
+      }
+
+      if (!strcmp(word, "-s")) {
+         flags |= LS_SORT;
+      } else if (!strcmp(word, "-p")) {
+         flags |= LS_PAGE;
+      } else {
+         return ERR_CMD_BAD_PARAM;
+      }
+
+      args = rest;
+   }
 
    /*
     * Nothing means just list the current device.
     */
-   if (strlen(args) == 0) {
+   if (word == NULL) {
       args = "/";
+   } else {
+      args = word;
    }
 
    err = file_path(args, &bi->default_dev, &path);
@@ -299,11 +462,11 @@ file_cmd_ls(char *args)
    }
 
    printk("Listing '%P'\n", path);
-   err = file_ls(path);
+   err = file_ls(path, flags);
 
-   free(path);
+   file_path_free(path);
    return err;
 }
 
-COMMAND(ls, file_cmd_ls, "list files given a [device:part][/fs/path]");
+COMMAND(ls, file_cmd_ls, "list files given [-s] [-p] [device:part][/fs/path]");
 
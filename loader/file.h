@@ -25,23 +25,45 @@ typedef struct {
    char *device;
    unsigned part;
    char *path;
+   bool pooled;
 } path_t;
 
+typedef struct {
+   length_t len;
+   uint32_t ino;
+   uint32_t mtime;
+} file_info_t;
+
 quik_err_t
 file_path(char *pathspec,
           env_dev_t *default_dev,
           path_t **path);
 
+void
+file_path_free(path_t *path);
+
 quik_err_t
 file_len(path_t *path,
          length_t *len);
 
+quik_err_t
+file_info(path_t *path,
+          file_info_t *info);
+
 quik_err_t
 file_load(path_t *path,
           void *buffer);
 
 quik_err_t
-file_ls(path_t *path);
+file_read(path_t *path,
+          file_info_t *info,
+          length_t offset,
+          length_t len,
+          void *buffer);
+
+quik_err_t
+file_ls(path_t *path,
+        unsigned flags);
 
 quik_err_t
 file_cmd_cat(char *pathspec);
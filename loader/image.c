@@ -0,0 +1,418 @@
+/*
+ * Loaded image handling.
+ *
+ * Kernels and initrds stay resident after they are read, so
+ * that retrying after a mistyped initrd path, or going back to
+ * the boot prompt to change just the kernel arguments, doesn't
+ * mean reading megabytes from disk again. A cached copy is
+ * reused only if the file still has the same device, partition,
+ * inode, size and mtime.
+ *
+ * The default image can also be read ahead a chunk at a time while
+ * the boot prompt counts down. Whatever got read by the time a key
+ * is pressed sits in the cache like anything else, so picking the
+ * default anyway just reads the rest, and picking something else
+ * lets it be evicted if the memory is needed.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "quik.h"
+#include "prom.h"
+#include "image.h"
+#include "task.h"
+#include <layout.h>
+
+#define IMAGE_CACHE_SIZE 4
+
+/*
+ * Read per idle call when prefetching. Small enough to
+ * not hold up noticing a key press.
+ */
+#define PREFETCH_CHUNK   (64 * 1024)
+
+typedef struct {
+   char *device;
+   unsigned part;
+   file_info_t info;
+   vaddr_t buf;
+
+   /* Less than info.len if prefetching stopped part way. */
+   length_t done;
+
+   /*
+    * Attempt the image was last used by. Images used by
+    * the current attempt are never evicted.
+    */
+   unsigned gen;
+} image_t;
+
+static image_t images[IMAGE_CACHE_SIZE];
+static unsigned image_gen = 1;
+
+static struct {
+   path_t *paths[2];
+   unsigned count;
+   unsigned next;
+
+   /* Being read, NULL between files. */
+   image_t *im;
+   vaddr_t where;
+} prefetch;
+
+static bool prefetch_step(void);
+static task_t prefetch_task = { prefetch_step, TASK_IDLE_ONLY };
+
+
+static void
+prefetch_stop(void)
+{
+   unsigned i;
+
+   task_stop(&prefetch_task);
+
+   for (i = 0; i < prefetch.count; i++) {
+      file_path_free(prefetch.paths[i]);
+   }
+
+   memset(&prefetch, 0, sizeof(prefetch));
+}
+
+
+/*
+ * Called before every load attempt.
+ */
+void
+image_begin(void)
+{
+   prefetch_stop();
+   image_gen++;
+}
+
+
+static image_t *
+image_find(path_t *path,
+           file_info_t *info)
+{
+   unsigned i;
+   image_t *im;
+
+   for (i = 0; i < IMAGE_CACHE_SIZE; i++) {
+      im = &images[i];
+      if (im->buf != 0 &&
+          im->part == path->part &&
+          im->info.ino == info->ino &&
+          im->info.len == info->len &&
+          im->info.mtime == info->mtime &&
+          !strcmp(im->device, path->device)) {
+         return im;
+      }
+   }
+
+   return NULL;
+}
+
+
+static void
+image_evict(image_t *im)
+{
+   prom_release((void *) im->buf, im->info.len);
+   free(im->device);
+   memset(im, 0, sizeof(*im));
+}
+
+
+/*
+ * Evict the least recently used image not needed
+ * by the current attempt.
+ */
+static bool
+image_evict_one(void)
+{
+   unsigned i;
+   image_t *victim = NULL;
+
+   for (i = 0; i < IMAGE_CACHE_SIZE; i++) {
+      if (images[i].buf == 0 ||
+          images[i].gen == image_gen) {
+         continue;
+      }
+
+      if (victim == NULL || images[i].gen < victim->gen) {
+         victim = &images[i];
+      }
+   }
+
+   if (victim == NULL) {
+      return false;
+   }
+
+   image_evict(victim);
+   return true;
+}
+
+
+static image_t *
+image_slot(void)
+{
+   unsigned i;
+
+   for (i = 0; i < IMAGE_CACHE_SIZE; i++) {
+      if (images[i].buf == 0) {
+         return &images[i];
+      }
+   }
+
+   if (!image_evict_one()) {
+      return NULL;
+   }
+
+   return image_slot();
+}
+
+
+quik_err_t
+image_load(path_t *path,
+           vaddr_t *where,
+           length_t *len)
+{
+   quik_err_t err;
+   image_t *im;
+   vaddr_t buf;
+   file_info_t info;
+
+   err = file_info(path, &info);
+   if (err != ERR_NONE) {
+      printk("Error fetching size for '%P': %r\n",
+             path, err);
+      return err;
+   }
+
+   *len = info.len;
+   im = image_find(path, &info);
+   if (im != NULL && im->done != info.len) {
+      printk("Loading rest of '%P' from %u KB\n", path, im->done >> 10);
+      err = file_read(path, &info, im->done, info.len - im->done,
+                      (void *) (im->buf + im->done));
+      if (err != ERR_NONE) {
+         printk("Error loading '%P': %r\n", path, err);
+         image_evict(im);
+         return err;
+      }
+
+      im->done = info.len;
+   } else if (im != NULL) {
+      printk("Reusing '%P' @ 0x%x\n", path, im->buf);
+   }
+
+   if (im != NULL) {
+      im->gen = image_gen;
+      *where = im->buf;
+      return ERR_NONE;
+   }
+
+   printk("Loading '%P'\n", path);
+   do {
+      buf = (vaddr_t) prom_claim_chunk((void *) *where, *len);
+   } while (buf == (vaddr_t) -1 && image_evict_one());
+
+   if (buf == (vaddr_t) -1) {
+      printk_err("Couldn't claim 0x%x bytes to load '%P'\n", *len, path);
+      return ERR_NO_MEM;
+   }
+
+   err = file_load(path, (void *) buf);
+   if (err != ERR_NONE) {
+      printk("Error loading '%P': %r\n", path, err);
+      prom_release((void *) buf, *len);
+      return err;
+   }
+
+   *where = buf;
+   im = image_slot();
+   if (im == NULL) {
+
+      /*
+       * Nothing to evict, so just don't cache it. The
+       * memory stays claimed for this attempt.
+       */
+      return ERR_NONE;
+   }
+
+   im->device = strdup(path->device);
+   if (im->device == NULL) {
+      return ERR_NONE;
+   }
+
+   im->part = path->part;
+   im->info = info;
+   im->buf = buf;
+   im->done = info.len;
+   im->gen = image_gen;
+   return ERR_NONE;
+}
+
+
+/*
+ * Queue kernel and initrd (which can be NULL) to be read in
+ * the background, taking ownership of the paths. Memory
+ * is claimed where try_load_loop would claim it.
+ */
+void
+image_prefetch(path_t *kernel,
+               path_t *initrd)
+{
+   prefetch_stop();
+   prefetch.paths[prefetch.count++] = kernel;
+   if (initrd != NULL) {
+      prefetch.paths[prefetch.count++] = initrd;
+   }
+
+   prefetch.where = LOAD_BASE;
+   task_start(&prefetch_task);
+}
+
+
+/*
+ * Moves on from im, done or already cached. The kernel comes
+ * first, and the next file has to go past its BSS, which isn't
+ * claimed until elf_parse runs on the loaded kernel.
+ */
+static void
+prefetch_next(image_t *im)
+{
+   length_t len = im->info.len;
+
+   if (prefetch.next == 0 &&
+       elf_mem_len((void *) im->buf, im->done) > len) {
+      len = elf_mem_len((void *) im->buf, im->done);
+   }
+
+   prefetch.where = im->buf + len;
+   prefetch.next++;
+}
+
+
+/*
+ * Opens the next queued file, and gets it a cache slot and memory.
+ * Files that are already cached are skipped. Unlike image_load,
+ * nothing is evicted to make room.
+ */
+static quik_err_t
+prefetch_start(path_t *path)
+{
+   quik_err_t err;
+   image_t *im;
+   vaddr_t buf;
+   file_info_t info;
+
+   err = file_info(path, &info);
+   if (err != ERR_NONE) {
+      return err;
+   }
+
+   im = image_find(path, &info);
+   if (im != NULL) {
+      prefetch_next(im);
+      return ERR_NONE;
+   }
+
+   for (im = images; im < images + IMAGE_CACHE_SIZE; im++) {
+      if (im->buf == 0) {
+         break;
+      }
+   }
+
+   if (im == images + IMAGE_CACHE_SIZE) {
+      return ERR_NO_MEM;
+   }
+
+   buf = (vaddr_t) prom_claim_chunk((void *) prefetch.where, info.len);
+   if (buf == (vaddr_t) -1) {
+      return ERR_NO_MEM;
+   }
+
+   im->device = strdup(path->device);
+   if (im->device == NULL) {
+      prom_release((void *) buf, info.len);
+      return ERR_NO_MEM;
+   }
+
+   im->part = path->part;
+   im->info = info;
+   im->buf = buf;
+   im->done = 0;
+   im->gen = image_gen;
+   prefetch.im = im;
+   return ERR_NONE;
+}
+
+
+/*
+ * Reads the next chunk of whatever image_prefetch queued.
+ * Any error just ends prefetching, as the boot path will
+ * run into it again and report it.
+ */
+static bool
+prefetch_step(void)
+{
+   quik_err_t err;
+   length_t chunk;
+   image_t *im;
+   path_t *path;
+
+   if (prefetch.next == prefetch.count) {
+      return false;
+   }
+
+   bi->flags |= BACKGROUND_IO;
+   path = prefetch.paths[prefetch.next];
+   if (prefetch.im == NULL) {
+      err = prefetch_start(path);
+      if (err != ERR_NONE || prefetch.im == NULL) {
+         goto out;
+      }
+   }
+
+   im = prefetch.im;
+   chunk = im->info.len - im->done;
+   if (chunk > PREFETCH_CHUNK) {
+      chunk = PREFETCH_CHUNK;
+   }
+
+   err = file_read(path, &im->info, im->done, chunk,
+                   (void *) (im->buf + im->done));
+   if (err != ERR_NONE) {
+      image_evict(im);
+      goto out;
+   }
+
+   im->done += chunk;
+   if (im->done == im->info.len) {
+      prefetch.im = NULL;
+      prefetch_next(im);
+   }
+
+out:
+   bi->flags &= ~BACKGROUND_IO;
+   if (err != ERR_NONE) {
+      prefetch_stop();
+      return false;
+   }
+
+   return prefetch.next != prefetch.count;
+}
@@ -0,0 +1,33 @@
+/*
+ * Loaded image handling.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef QUIK_IMAGE_H
+#define QUIK_IMAGE_H
+
+#include "quik.h"
+#include "file.h"
+
+void image_begin(void);
+quik_err_t image_load(path_t *path,
+                      vaddr_t *where,
+                      length_t *len);
+void image_prefetch(path_t *kernel, path_t *initrd);
+
+#endif /* QUIK_IMAGE_H */
@@ -44,7 +44,16 @@ typedef struct {
    uint32_t r31; /* 76 */
 } jmp_buf;
 
+#ifdef CONFIG_HOST
+/*
+ * The hosted build has no setjmp.S. The GCC builtins need
+ * 5 words, and val can only be 1.
+ */
+#define setjmp(env) __builtin_setjmp((void **) &(env))
+#define longjmp(env, val) __builtin_longjmp((void **) &(env), 1)
+#else
 int setjmp(jmp_buf env);
 void longjmp(jmp_buf env, int val) __attribute__ ((__noreturn__));
+#endif /* CONFIG_HOST */
 
 #endif /* ISETJMP_H */
@@ -31,6 +31,10 @@
 #include "quik.h"
 #include "file.h"
 #include "prom.h"
+#include "image.h"
+#include "timing.h"
+#include "devtree.h"
+#include "trace.h"
 #include <layout.h>
 
 #include "commands.h"
@@ -81,7 +85,7 @@ make_params(char *label,
    q = buffer;
    *q = 0;
 
-   p = cfg_get_strg(label, "literal");
+   p = cfg_get_strg(label, CFG_LITERAL);
    if (p) {
       strcpy(q, p);
       q = strchr(q, 0);
@@ -93,29 +97,29 @@ make_params(char *label,
       return buffer;
    }
 
-   p = cfg_get_strg(label, "root");
+   p = cfg_get_strg(label, CFG_ROOT);
    if (p) {
       strcpy (q, "root=");
       strcpy (q + 5, p);
       q = strchr (q, 0);
       *q++ = ' ';
    }
-   if (cfg_get_flag(label, "read-only")) {
+   if (cfg_get_flag(label, CFG_READ_ONLY)) {
       strcpy (q, "ro ");
       q += 3;
    }
-   if (cfg_get_flag(label, "read-write")) {
+   if (cfg_get_flag(label, CFG_READ_WRITE)) {
       strcpy (q, "rw ");
       q += 3;
    }
-   p = cfg_get_strg(label, "ramdisk");
+   p = cfg_get_strg(label, CFG_RAMDISK);
    if (p) {
       strcpy (q, "ramdisk=");
       strcpy (q + 8, p);
       q = strchr (q, 0);
       *q++ = ' ';
    }
-   p = cfg_get_strg (label, "append");
+   p = cfg_get_strg(label, CFG_APPEND);
    if (p) {
       strcpy (q, p);
       q = strchr (q, 0);
@@ -123,11 +127,11 @@ make_params(char *label,
    }
    *q = 0;
 
-   if (cfg_get_flag (label, "pause-after")) {
+   if (cfg_get_flag(label, CFG_PAUSE_AFTER)) {
       bi->flags |= PAUSE_BEFORE_BOOT;
    }
 
-   p = cfg_get_strg(label, "pause-message");
+   p = cfg_get_strg(label, CFG_PAUSE_MESSAGE);
    if (p) {
       bi->pause_message = p;
    }
@@ -140,14 +144,56 @@ make_params(char *label,
 }
 
 
+/*
+ * Use the quik.conf the installer compiled into the boot block, as
+ * long as the one on disk is still the same file.
+ */
 static quik_err_t
-load_config(void)
+load_compiled_config(path_t *path)
+{
+   quik_err_t err;
+   file_info_t info;
+   bootconf_t *bc;
+
+   bc = cfg_compiled();
+   if (bc == NULL) {
+      return ERR_CONFIG_NOT_FOUND;
+   }
+
+   path->path = (char *) bc + be32_to_cpu(bc->conf_path);
+   if ((bi->flags & CONFIG_FILE_GIVEN) != 0 &&
+       strcmp(path->path, bi->config_file) != 0) {
+      return ERR_CONFIG_NOT_FOUND;
+   }
+
+   err = file_info(path, &info);
+   if (err == ERR_NONE &&
+       (info.ino != be32_to_cpu(bc->conf_ino) ||
+        info.mtime != be32_to_cpu(bc->conf_mtime) ||
+        info.len != be32_to_cpu(bc->conf_len))) {
+      err = ERR_CONFIG_STALE;
+   }
+
+   if (err != ERR_NONE) {
+      printk("Not using compiled configuration for '%P': %r\n", path, err);
+      return err;
+   }
+
+   printk("Using compiled configuration for '%P'\n", path);
+   if (cfg_parse_compiled(bc) < 0) {
+      printk_err("Error in compiled configuration for '%P'\n", path);
+      return ERR_CONFIG_BAD;
+   }
+
+   return ERR_NONE;
+}
+
+
+static quik_err_t
+load_text_config(path_t *path)
 {
    length_t len;
    char *buf;
-   char *endp;
-   char *p;
-   path_t path;
    unsigned n = 0;
    quik_err_t err = ERR_NONE;
    char *attempts[] = {
@@ -159,22 +205,11 @@ load_config(void)
       NULL
    };
 
-   err = env_dev_is_valid(&bi->default_dev);
-   if (err != ERR_NONE) {
-      if (err == ERR_ENV_CURRENT_BAD) {
-         err = ERR_ENV_DEFAULT_BAD;
-      }
-
-      return err;
-   }
-
-   path.device = bi->default_dev.device;
-   path.part = bi->default_dev.part;
    while (attempts[n] != NULL) {
-      path.path = attempts[n];
+      path->path = attempts[n];
 
-      printk("Trying configuration file @ '%P'\n", &path);
-      err = file_len(&path, &len);
+      printk("Trying configuration file @ '%P'\n", path);
+      err = file_len(path, &len);
       if (err == ERR_NONE) {
          break;
       }
@@ -187,39 +222,82 @@ load_config(void)
       return ERR_CONFIG_NOT_FOUND;
    }
 
-   buf = malloc(len);
+   /*
+    * Parsed values point into buf, so it is kept.
+    */
+   buf = malloc(len + 1);
    if (buf == NULL) {
       return ERR_NO_MEM;
    }
 
-   err = file_load(&path, buf);
+   err = file_load(path, buf);
    if (err != ERR_NONE) {
-      printk("\nCouldn't load '%P': %r\n", &path, err);
+      printk("\nCouldn't load '%P': %r\n", path, err);
       free(buf);
       return err;
    }
 
    if (cfg_parse(bi->config_file, buf, len) < 0) {
-      printk ("Syntax error or read error in '%P'\n", &path);
+      printk_err("Syntax error or read error in '%P'\n", path);
+   }
+
+   return ERR_NONE;
+}
+
+
+static quik_err_t
+load_config(void)
+{
+   char *endp;
+   char *p;
+   path_t path;
+   unsigned n;
+   quik_err_t err;
+
+   err = env_dev_is_valid(&bi->default_dev);
+   if (err != ERR_NONE) {
+      if (err == ERR_ENV_CURRENT_BAD) {
+         err = ERR_ENV_DEFAULT_BAD;
+      }
+
+      return err;
+   }
+
+   path.device = bi->default_dev.device;
+   path.part = bi->default_dev.part;
+   path.pooled = false;
+   err = load_compiled_config(&path);
+   if (err != ERR_NONE) {
+      err = load_text_config(&path);
+      if (err != ERR_NONE) {
+         return err;
+      }
    }
 
-   free(buf);
    bi->flags |= CONFIG_VALID;
-   p = cfg_get_strg(0, "init-code");
+   if (cfg_get_flag(NULL, CFG_QUIET)) {
+      prom_set_quiet(true);
+   }
+
+   if (cfg_get_flag(NULL, CFG_PROGRESS)) {
+      bi->flags |= SHOW_PROGRESS;
+   }
+
+   p = cfg_get_strg(NULL, CFG_INIT_CODE);
    if (p) {
       prom_interpret(p);
    }
 
-   p = cfg_get_strg(0, "init-message");
+   p = cfg_get_strg(NULL, CFG_INIT_MESSAGE);
    if (p) {
       printk("%s\n", p);
    }
 
-   if(cfg_get_strg(0, "device") != NULL) {
-      bi->default_dev.device = cfg_get_strg(0, "device");
+   if(cfg_get_strg(NULL, CFG_DEVICE) != NULL) {
+      bi->default_dev.device = cfg_get_strg(NULL, CFG_DEVICE);
    }
 
-   p = cfg_get_strg(0, "partition");
+   p = cfg_get_strg(NULL, CFG_PARTITION);
    if (p) {
       n = strtol(p, &endp, 10);
       if (endp != p && *endp == 0) {
@@ -227,12 +305,12 @@ load_config(void)
       }
    }
 
-   p = cfg_get_strg(0, "pause-message");
+   p = cfg_get_strg(NULL, CFG_PAUSE_MESSAGE);
    if (p) {
       bi->pause_message = p;
    }
 
-   p = cfg_get_strg(0, "message");
+   p = cfg_get_strg(NULL, CFG_MESSAGE);
    if (p) {
       file_cmd_cat(p);
    }
@@ -283,6 +361,112 @@ cmd_of_interp(char *args)
 COMMAND(of, cmd_of_interp, "intepret a series of OF commands");
 
 
+/*
+ * Apply an image's device and partition, if it has them.
+ */
+static void
+label_dev(char *label,
+          env_dev_t *dev)
+{
+   char *p;
+   char *endp;
+   int n;
+
+   p = cfg_get_strg(label, CFG_DEVICE);
+   if (p) {
+      dev->device = p;
+   }
+
+   p = cfg_get_strg(label, CFG_PARTITION);
+   if (p) {
+      n = strtol(p, &endp, 10);
+      if (endp != p && *endp == 0) {
+         env_dev_set_part(dev, n);
+      }
+   }
+}
+
+
+/*
+ * Paths for kernel_spec and initrd_spec (which can be NULL). On
+ * error, *kernel is NULL if it was kernel_spec that was bad.
+ */
+static quik_err_t
+spec_paths(char *kernel_spec,
+           char *initrd_spec,
+           env_dev_t *cur_dev,
+           path_t **kernel,
+           path_t **initrd)
+{
+   quik_err_t err;
+
+   *kernel = NULL;
+   *initrd = NULL;
+
+   /*
+    * In case get_params didn't set the device or partition,
+    * propagate from the default device path.
+    */
+   env_dev_update_from_default(cur_dev);
+
+   err = file_path(kernel_spec, cur_dev, kernel);
+   if (err != ERR_NONE) {
+      *kernel = NULL;
+      return err;
+   }
+
+   /*
+    * If cur_dev is bogus, fill it with dev info
+    * from parsing the kernel path. This lets you
+    * be less verbose speccing out the initrd path.
+    */
+   if (env_dev_is_valid(cur_dev) != ERR_NONE) {
+      env_dev_set_part(cur_dev, (*kernel)->part);
+      cur_dev->device = (*kernel)->device;
+   }
+
+   if (initrd_spec != NULL) {
+      err = file_path(initrd_spec, cur_dev, initrd);
+      if (err != ERR_NONE) {
+         *initrd = NULL;
+         return err;
+      }
+   }
+
+   return ERR_NONE;
+}
+
+
+/*
+ * Start reading the kernel and initrd for label while the
+ * prompt counts down, so booting it needn't wait for the disk.
+ */
+static void
+prefetch_default(char *label)
+{
+   char *p;
+   char *initrd;
+   path_t *kernel_path;
+   path_t *initrd_path;
+   env_dev_t cur_dev = { 0 };
+
+   p = cfg_get_strg(label, CFG_IMAGE);
+   if (p == NULL || *p == '\0') {
+      return;
+   }
+
+   label_dev(label, &cur_dev);
+   initrd = cfg_get_strg(label, CFG_INITRD);
+   if (spec_paths(p, initrd, &cur_dev, &kernel_path,
+                  &initrd_path) != ERR_NONE) {
+      file_path_free(kernel_path);
+      return;
+   }
+
+   image_prefetch(kernel_path, initrd_path);
+}
+
+
 static quik_err_t
 get_params(char **kernel,
            char **initrd,
@@ -291,9 +475,7 @@ get_params(char **kernel,
 {
    char *p;
    char *q;
-   int n;
    char *buf;
-   char *endp;
    key_t lastkey;
    char *label = NULL;
    int timeout = DEFAULT_TIMEOUT;
@@ -313,9 +495,13 @@ get_params(char **kernel,
           * passed.
           */
          if ((bi->flags & CONFIG_VALID) &&
-             (q = cfg_get_strg(0, "timeout")) != 0 && *q != 0) {
+             (q = cfg_get_strg(NULL, CFG_TIMEOUT)) != 0 && *q != 0) {
            timeout = strtol(q, NULL, 0);
          }
+
+         if (timeout > 0) {
+            prefetch_default(*kernel);
+         }
       } else {
 
          /*
@@ -341,6 +527,13 @@ get_params(char **kernel,
    } else {
       *kernel = NULL;
 
+      /*
+       * Interactive use, so stop being quiet.
+       */
+      if (prom_set_quiet(false)) {
+         printk(PROMPT);
+      }
+
       buf = cmd_edit(maintabfunc, lastkey);
       if (buf == NULL) {
          return ERR_NOT_READY;
@@ -351,31 +544,19 @@ get_params(char **kernel,
    }
 
    if (bi->flags & CONFIG_VALID) {
-      *initrd = cfg_get_strg(0, "initrd");
-      p = cfg_get_strg(*kernel, "image");
+      *initrd = cfg_get_strg(NULL, CFG_INITRD);
+      p = cfg_get_strg(*kernel, CFG_IMAGE);
       if (p && *p) {
          label = *kernel;
          *kernel = p;
+         label_dev(label, cur_dev);
 
-         p = cfg_get_strg(label, "device");
-         if (p) {
-            cur_dev->device = p;
-         }
-
-         p = cfg_get_strg(label, "partition");
-         if (p) {
-            n = strtol(p, &endp, 10);
-            if (endp != p && *endp == 0) {
-               env_dev_set_part(cur_dev, n);
-            }
-         }
-
-         p = cfg_get_strg(label, "initrd");
+         p = cfg_get_strg(label, CFG_INITRD);
          if (p) {
             *initrd = p;
          }
 
-         if (cfg_get_strg(label, "old-kernel")) {
+         if (cfg_get_flag(label, CFG_OLD_KERNEL)) {
             bi->flags |= BOOT_PRE_2_4;
          } else {
             bi->flags &= ~BOOT_PRE_2_4;
@@ -432,74 +613,15 @@ get_load_paths(path_t **kernel,
       return err;
    }
 
-   /*
-    * In case get_params didn't set the device or partition,
-    * propagate from the default device path.
-    */
-   env_dev_update_from_default(&cur_dev);
-
-   err = file_path(kernel_spec,
-                   &cur_dev,
-                   kernel);
-   if (err != ERR_NONE) {
+   err = spec_paths(kernel_spec, initrd_spec, &cur_dev, kernel, initrd);
+   if (err != ERR_NONE && *kernel == NULL) {
       printk("Error parsing kernel path '%s': %r\n", kernel_spec, err);
-      return err;
-   }
-
-   /*
-    * If cur_dev is bogus, fill it with dev info
-    * from parsing the kernel path. This lets you
-    * be less verbose speccing out the initrd path.
-    */
-   if (env_dev_is_valid(&cur_dev) != ERR_NONE) {
-      env_dev_set_part(&cur_dev, (*kernel)->part);
-      cur_dev.device = (*kernel)->device;
-   }
-
-   if (initrd_spec != NULL) {
-      err = file_path(initrd_spec,
-                      &cur_dev,
-                      initrd);
-      if (err != ERR_NONE) {
-         printk("Error parsing initrd path '%s': %r\n", initrd_spec, err);
-         free(kernel);
-         return err;
-      }
-   }
-
-   return ERR_NONE;
-}
-
-
-static quik_err_t
-load_image(path_t *path,
-           vaddr_t *where,
-           length_t *len)
-{
-   quik_err_t err;
-
-   printk("Loading '%P'\n", path);
-   err = file_len(path, len);
-   if (err != ERR_NONE) {
-      printk("Error fetching size for '%P': %r\n",
-             path, err);
-      return err;
+   } else if (err != ERR_NONE) {
+      printk("Error parsing initrd path '%s': %r\n", initrd_spec, err);
+      file_path_free(*kernel);
    }
 
-   *where = (vaddr_t) prom_claim_chunk((void *) *where, *len);
-   if (*where == (vaddr_t) -1) {
-      printk("Couldn't claim 0x%x bytes to load '%P'\n", *len, path);
-      return ERR_NO_MEM;
-   }
-
-   err = file_load(path, (void *) *where);
-   if (err != ERR_NONE) {
-      printk("Error loading '%P': %r\n", path, err);
-      prom_release((void *) *where, *len);
-      return err;
-   }
-
-   return ERR_NONE;
+   return err;
 }
 
 
@@ -515,13 +637,16 @@ try_load_loop(load_state_t *image,
    path_t *kernel_path = NULL;
    path_t *initrd_path = NULL;
 
+   timing_mark("prompt");
    err = get_load_paths(&kernel_path, &initrd_path, params);
    if (err != ERR_NONE) {
       return err;
    }
 
+   timing_mark("kernel");
+   image_begin();
    kernel_buf = LOAD_BASE;
-   err = load_image(kernel_path, &kernel_buf, &kernel_len);
+   err = image_load(kernel_path, &kernel_buf, &kernel_len);
    if (err == ERR_NONE) {
       err = elf_parse((void *) kernel_buf, kernel_len, image);
    }
@@ -537,8 +662,9 @@ try_load_loop(load_state_t *image,
       return ERR_NONE;
    }
 
+   timing_mark("initrd");
    initrd_buf = kernel_buf + kernel_len;
-   err = load_image(initrd_path, &initrd_buf, &initrd_len);
+   err = image_load(initrd_path, &initrd_buf, &initrd_len);
    if (err != ERR_NONE) {
       goto out;
    }
@@ -548,17 +674,13 @@ try_load_loop(load_state_t *image,
    return ERR_NONE;
 
 out:
-   if (kernel_buf) {
-      prom_release((void *) kernel_buf, kernel_len);
-   }
 
-   if (initrd_path) {
-      free(initrd_path);
-   }
-
-   if (kernel_path) {
-      free(kernel_path);
-   }
+   /*
+    * Whatever got loaded stays in the image cache, so
+    * picking the same kernel again won't reread it.
+    */
+   file_path_free(initrd_path);
+   file_path_free(kernel_path);
 
    return err;
 }
@@ -590,21 +712,35 @@ iquik_main(void *a1,
       goto error;
    }
 
+#ifndef CONFIG_TINY
+   if (prom_bootargs_has("trace")) {
+      trace_start(TRACE_DEFAULT_RECORDS);
+   }
+#endif /* CONFIG_TINY */
+
    err = cmd_init();
    if (err != ERR_NONE) {
       goto error;
    }
 
+   timing_mark("env_init");
    err = env_init();
    if (err != ERR_NONE) {
       goto error;
    }
 
+   timing_mark("load_config");
    err = load_config();
    if (err != ERR_NONE) {
       printk("No configration file parsed: %r\n", err);
    }
 
+   /*
+    * Not before, as init-code can change the tree. Forth run
+    * later from the prompt drops the snapshot itself.
+    */
+   devtree_start();
+
    for (;;) {
       params = NULL;
 
@@ -614,7 +750,9 @@ iquik_main(void *a1,
       }
    }
 
+   timing_mark("elf_relo");
    err = elf_relo(&image);
+   timing_mark(NULL);
    if (err != ERR_NONE) {
       goto error;
    }
@@ -625,6 +763,13 @@ iquik_main(void *a1,
       bi->flags ^= SHIM_OF;
    }
 
+   timing_mark("devtree");
+   err = devtree_snapshot();
+   timing_mark(NULL);
+   if (err != ERR_NONE) {
+      printk("No device tree snapshot: %r\n", err);
+   }
+
    if (bi->flags & DEBUG_BEFORE_BOOT) {
       if (bi->flags & BOOT_PRE_2_4) {
          printk("Booting pre-2.4 kernel\n");
@@ -634,6 +779,10 @@ iquik_main(void *a1,
       printk("Initrd: 0x%x @ 0x%x\n", bi->initrd_len, bi->initrd_base);
       printk("Kernel parameters: %s\n", params);
       printk("Kernel entry: 0x%x\n", image.entry);
+      timing_print();
+#ifdef CONFIG_HEAP_STATS
+      malloc_stats();
+#endif /* CONFIG_HEAP_STATS */
       prom_pause(NULL);
    } else if (bi->flags & PAUSE_BEFORE_BOOT) {
       prom_pause(bi->pause_message);
@@ -1,5 +1,5 @@
 /*
- * Dumb memory allocation routines
+ * Memory allocation routines
  *
  * Copyright (C) 1997 Paul Mackerras
  * 1996 Maurizio Plaza
@@ -23,10 +23,76 @@
 #include <layout.h>
 #include "quik.h"
 #include "prom.h"
+#include "commands.h"
+#include "pool.h"
+
+#ifdef CONFIG_HEAP_STATS
+#undef malloc
+#undef free
+#undef realloc
+#endif /* CONFIG_HEAP_STATS */
+
+/*
+ * Every block is preceded by a header. Small blocks are rounded
+ * up to a size class and recycled via per-class free lists. Larger
+ * blocks go on an address-ordered free list, where neighbours are
+ * merged on free. Anything the free lists can't satisfy is carved
+ * off the top of the arena, and blocks freed at the top lower it
+ * again, so mark()/release() keep working as before.
+ */
+#define MALLOC_ALIGN       8
+#define MALLOC_MAGIC_USED  0x4d55
+#define MALLOC_MAGIC_FREE  0x4d46
+#define MALLOC_SMALL_MAX   256
+#define MALLOC_CLASSES     5
+
+typedef struct malloc_hdr {
+
+   /* Block size, including this header. */
+   length_t size;
+   uint16_t magic;
+
+   /* Allocation site, for CONFIG_HEAP_STATS. */
+   uint16_t site;
+} malloc_hdr_t;
+
+typedef struct malloc_free {
+   malloc_hdr_t hdr;
+   struct malloc_free *next;
+} malloc_free_t;
+
+#define HDR(p) ((malloc_hdr_t *) (p) - 1)
+#define BLOCK_END(b) ((char *) (b) + ((malloc_hdr_t *) (b))->size)
+
+static const length_t class_size[MALLOC_CLASSES] = {
+   16, 32, 64, 128, MALLOC_SMALL_MAX
+};
+
+/*
+ * The initial arena at MALLOC_BASE is region 0. Once it is
+ * exhausted, more regions are claimed from the top of RAM,
+ * and the top-most region is the one allocations are carved
+ * from.
+ */
+#define MALLOC_REGIONS     8
+#define MALLOC_GROW_SIZE   SIZE_1M
+
+typedef struct {
+   char *base;
+   char *end;
+} malloc_region_t;
 
 static char *malloc_ptr = NULL;
 static char *malloc_end = NULL;
-static char *last_alloc = 0;
+static malloc_free_t *small_free[MALLOC_CLASSES];
+static malloc_free_t *large_free = NULL;
+static malloc_region_t regions[MALLOC_REGIONS];
+static unsigned region_count = 0;
+static length_t heap_size = 0;
+
+static void malloc_free_large(malloc_free_t *b);
+static void malloc_free_small(char *p, length_t size);
+
 
 quik_err_t
 malloc_init()
@@ -37,54 +103,591 @@ malloc_init()
    }
 
    malloc_end = malloc_ptr + MALLOC_SIZE;
+   regions[0].base = malloc_ptr;
+   regions[0].end = malloc_end;
+   region_count = 1;
+   heap_size = MALLOC_SIZE;
    return ERR_NONE;
 }
 
 
+/*
+ * Total bytes claimed for the heap so far, for
+ * anything that wants to size caches by it.
+ */
+length_t
+malloc_heap_size(void)
+{
+   return heap_size;
+}
+
+
+/*
+ * Claim a new region big enough for bsize. Whatever is
+ * left at the top of the current region becomes free
+ * blocks.
+ */
+static bool
+malloc_grow(length_t bsize)
+{
+   char *base;
+   length_t size;
+   malloc_free_t *rest;
+
+   if (region_count == MALLOC_REGIONS) {
+      return false;
+   }
+
+   size = ALIGN_UP(bsize, MALLOC_GROW_SIZE);
+   base = prom_claim_chunk_high((void *) MALLOC_GROW_FLOOR, size);
+   if (base == (char *) -1) {
+      return false;
+   }
+
+   if ((length_t) (malloc_end - malloc_ptr) > MALLOC_SMALL_MAX) {
+      rest = (malloc_free_t *) malloc_ptr;
+      rest->hdr.size = malloc_end - malloc_ptr;
+      rest->hdr.magic = MALLOC_MAGIC_FREE;
+      malloc_free_large(rest);
+   } else {
+      malloc_free_small(malloc_ptr, malloc_end - malloc_ptr);
+   }
+
+   regions[region_count].base = base;
+   regions[region_count].end = base + size;
+   region_count++;
+   heap_size += size;
+
+   malloc_ptr = base;
+   malloc_end = base + size;
+
+   printk("Heap grown by 0x%x bytes @ %p, now 0x%x bytes\n",
+          size, base, heap_size);
+   return true;
+}
+
+
+static unsigned
+malloc_class(length_t bsize)
+{
+   unsigned c = 0;
+
+   while (class_size[c] < bsize) {
+      c++;
+   }
+
+   return c;
+}
+
+
+/*
+ * Free space of up to MALLOC_SMALL_MAX bytes would never be
+ * handed out from the large list, so it is cut into small
+ * class blocks instead. Anything under the smallest class
+ * is lost.
+ */
+static void
+malloc_free_small(char *p,
+                  length_t size)
+{
+   unsigned c = MALLOC_CLASSES;
+   malloc_free_t *b;
+
+   while (c-- > 0) {
+      while (size >= class_size[c]) {
+         b = (malloc_free_t *) p;
+         b->hdr.size = class_size[c];
+         b->hdr.magic = MALLOC_MAGIC_FREE;
+         b->next = small_free[c];
+         small_free[c] = b;
+         p += class_size[c];
+         size -= class_size[c];
+      }
+   }
+}
+
+
+/*
+ * Large free blocks that end up touching the top of the
+ * arena are given back to it. Regions are claimed downwards,
+ * so blocks in earlier regions sort after this one.
+ */
+static void
+malloc_trim_top(void)
+{
+   malloc_free_t **pp = &large_free;
+
+   while (*pp != NULL) {
+      if (BLOCK_END(*pp) == malloc_ptr &&
+          (char *) *pp >= regions[region_count - 1].base) {
+         malloc_ptr = (char *) *pp;
+         *pp = (*pp)->next;
+         return;
+      }
+
+      pp = &(*pp)->next;
+   }
+}
+
+
+static unsigned
+malloc_region(void *p)
+{
+   unsigned r;
+
+   for (r = 0; r < region_count - 1; r++) {
+      if ((char *) p >= regions[r].base &&
+          (char *) p < regions[r].end) {
+         break;
+      }
+   }
+
+   return r;
+}
+
+
+/*
+ * Regions may happen to be adjacent, but blocks are
+ * never merged across them, so that release() can
+ * drop a region cleanly.
+ */
+static void
+malloc_free_large(malloc_free_t *b)
+{
+   malloc_free_t *prev = NULL;
+   malloc_free_t *next = large_free;
+
+   while (next != NULL && next < b) {
+      prev = next;
+      next = next->next;
+   }
+
+   b->next = next;
+   if (next != NULL && BLOCK_END(b) == (char *) next &&
+       malloc_region(b) == malloc_region(next)) {
+      b->hdr.size += next->hdr.size;
+      b->next = next->next;
+   }
+
+   if (prev == NULL) {
+      large_free = b;
+   } else if (BLOCK_END(prev) == (char *) b &&
+              malloc_region(prev) == malloc_region(b)) {
+      prev->hdr.size += b->hdr.size;
+      prev->next = b->next;
+   } else {
+      prev->next = b;
+   }
+}
+
+
+static void *
+malloc_large(length_t bsize)
+{
+   malloc_free_t **pp;
+   malloc_free_t *b;
+   malloc_free_t *rest;
+   length_t left;
+
+   for (pp = &large_free; *pp != NULL; pp = &(*pp)->next) {
+      b = *pp;
+      if (b->hdr.size < bsize) {
+         continue;
+      }
+
+      left = b->hdr.size - bsize;
+      if (left > MALLOC_SMALL_MAX) {
+         rest = (malloc_free_t *) ((char *) b + bsize);
+         rest->hdr.size = left;
+         rest->hdr.magic = MALLOC_MAGIC_FREE;
+         rest->next = b->next;
+         *pp = rest;
+         b->hdr.size = bsize;
+      } else {
+
+         /*
+          * What the small classes can't use stays with b.
+          */
+         *pp = b->next;
+         b->hdr.size = bsize + left % class_size[0];
+         malloc_free_small(BLOCK_END(b), left - left % class_size[0]);
+      }
+
+      return b;
+   }
+
+   return NULL;
+}
+
+
 void *malloc(unsigned int size)
 {
-   char *caddr;
+   unsigned c;
+   length_t bsize;
+   malloc_hdr_t *h = NULL;
 
-   if ((malloc_ptr + size + sizeof(int)) >= malloc_end) {
+   bsize = ALIGN_UP(size + sizeof(malloc_hdr_t), MALLOC_ALIGN);
+   if (bsize < size) {
       return NULL;
    }
 
-   *(int *)malloc_ptr = size;
-   caddr = malloc_ptr + sizeof(int);
-   malloc_ptr += size + sizeof(int);
-   last_alloc = caddr;
-   malloc_ptr = (char *) ((((unsigned int) malloc_ptr) + 3) & (~3));
-   return caddr;
+   if (bsize <= MALLOC_SMALL_MAX) {
+      c = malloc_class(bsize);
+      bsize = class_size[c];
+      if (small_free[c] != NULL) {
+         h = &small_free[c]->hdr;
+         small_free[c] = small_free[c]->next;
+      }
+   } else {
+      h = malloc_large(bsize);
+   }
+
+   if (h == NULL) {
+      if (bsize > (length_t) (malloc_end - malloc_ptr) &&
+          !malloc_grow(bsize)) {
+         return NULL;
+      }
+
+      h = (malloc_hdr_t *) malloc_ptr;
+      h->size = bsize;
+      malloc_ptr += bsize;
+   }
+
+   h->magic = MALLOC_MAGIC_USED;
+   return h + 1;
 }
 
+
 void *realloc(void *ptr, unsigned int size)
 {
-   char *caddr, *oaddr = ptr;
+   char *caddr;
+   length_t bsize;
+   malloc_hdr_t *h;
+
+   if (ptr == NULL) {
+      return malloc(size);
+   }
 
-   if (oaddr == last_alloc) {
-      *(int *)(oaddr - sizeof(int)) = size;
-      malloc_ptr = oaddr + size;
-      return oaddr;
+   h = HDR(ptr);
+   bsize = ALIGN_UP(size + sizeof(malloc_hdr_t), MALLOC_ALIGN);
+   if (bsize <= h->size) {
+      return ptr;
+   }
+
+   /*
+    * Last block in the arena can just grow in place, as long
+    * as it doesn't end up an odd size in small-class range.
+    */
+   if (BLOCK_END(h) == malloc_ptr &&
+       bsize > MALLOC_SMALL_MAX &&
+       bsize - h->size <= (length_t) (malloc_end - malloc_ptr)) {
+      malloc_ptr += bsize - h->size;
+      h->size = bsize;
+      return ptr;
    }
 
    caddr = malloc(size);
-   if (caddr != 0 && oaddr != 0)
-      memcpy(caddr, oaddr, *(int *)(oaddr - sizeof(int)));
+   if (caddr != NULL) {
+      memcpy(caddr, ptr, h->size - sizeof(malloc_hdr_t));
+      free(ptr);
+   }
+
    return caddr;
 }
 
+
 void free(void *m)
 {
-   if (m == last_alloc)
-      malloc_ptr = (char *) last_alloc - sizeof(int);
+   malloc_hdr_t *h;
+   malloc_free_t *b;
+
+   if (m == NULL) {
+      return;
+   }
+
+   h = HDR(m);
+   if (h->magic != MALLOC_MAGIC_USED) {
+
+      /*
+       * Double free or not ours.
+       */
+      return;
+   }
+
+   h->magic = MALLOC_MAGIC_FREE;
+   b = (malloc_free_t *) h;
+
+   if (BLOCK_END(h) == malloc_ptr) {
+      malloc_ptr = (char *) h;
+      malloc_trim_top();
+   } else if (h->size <= MALLOC_SMALL_MAX) {
+      b->next = small_free[malloc_class(h->size)];
+      small_free[malloc_class(h->size)] = b;
+   } else {
+      malloc_free_large(b);
+   }
 }
 
+
 void mark(void **ptr)
 {
    *ptr = (void *) malloc_ptr;
 }
 
+
+/*
+ * Is p still part of the heap after releasing to
+ * malloc_ptr in region r?
+ */
+static bool
+malloc_kept(char *p, unsigned r)
+{
+   unsigned i;
+
+   for (i = 0; i < r; i++) {
+      if (p >= regions[i].base && p < regions[i].end) {
+         return true;
+      }
+   }
+
+   return p >= regions[r].base && p < malloc_ptr;
+}
+
+
+/*
+ * Everything allocated after the matching mark() goes away,
+ * including any free blocks above the mark and any regions
+ * the heap grew into since.
+ */
 void release(void *ptr)
 {
+   unsigned c;
+   unsigned r;
+   malloc_free_t **pp;
+
+   for (r = region_count - 1; r > 0; r--) {
+      if ((char *) ptr >= regions[r].base &&
+          (char *) ptr <= regions[r].end) {
+         break;
+      }
+
+      prom_release(regions[r].base, regions[r].end - regions[r].base);
+      heap_size -= regions[r].end - regions[r].base;
+   }
+
+   region_count = r + 1;
    malloc_ptr = (char *) ptr;
+   malloc_end = regions[r].end;
+
+   for (c = 0; c < MALLOC_CLASSES; c++) {
+      pp = &small_free[c];
+      while (*pp != NULL) {
+         if (!malloc_kept((char *) *pp, r)) {
+            *pp = (*pp)->next;
+         } else {
+            pp = &(*pp)->next;
+         }
+      }
+   }
+
+   pp = &large_free;
+   while (*pp != NULL) {
+      if (!malloc_kept((char *) *pp, r)) {
+         *pp = (*pp)->next;
+         continue;
+      }
+
+      if ((char *) *pp < malloc_ptr &&
+          BLOCK_END(*pp) > malloc_ptr) {
+         (*pp)->hdr.size = malloc_ptr - (char *) *pp;
+      }
+
+      pp = &(*pp)->next;
+   }
+
+   malloc_trim_top();
 }
+
+
+#ifdef CONFIG_HEAP_STATS
+/*
+ * Per call-site accounting. The subsystem is the file
+ * the call was made from. Site 0 collects everything
+ * that didn't fit in the table.
+ */
+#define HEAP_SITES 64
+
+typedef struct {
+   char *file;
+   unsigned line;
+   unsigned allocs;
+   unsigned frees;
+   unsigned reallocs;
+   length_t live;
+   length_t peak;
+} heap_site_t;
+
+static heap_site_t heap_sites[HEAP_SITES] = {
+   { .file = "<other>" }
+};
+static unsigned heap_site_count = 1;
+static length_t heap_live = 0;
+static length_t heap_peak = 0;
+
+
+static unsigned
+heap_site(char *file, unsigned line)
+{
+   unsigned i;
+
+   for (i = 1; i < heap_site_count; i++) {
+      if (heap_sites[i].line == line &&
+          heap_sites[i].file == file) {
+         return i;
+      }
+   }
+
+   if (heap_site_count == HEAP_SITES) {
+      return 0;
+   }
+
+   heap_sites[i].file = file;
+   heap_sites[i].line = line;
+   heap_site_count++;
+   return i;
+}
+
+
+static void
+heap_account_alloc(void *p, unsigned site)
+{
+   heap_site_t *s = &heap_sites[site];
+
+   HDR(p)->site = site;
+   s->live += HDR(p)->size;
+   if (s->live > s->peak) {
+      s->peak = s->live;
+   }
+
+   heap_live += HDR(p)->size;
+   if (heap_live > heap_peak) {
+      heap_peak = heap_live;
+   }
+}
+
+
+static void
+heap_account_free(void *p)
+{
+   heap_site_t *s = &heap_sites[HDR(p)->site];
+
+   s->frees++;
+   s->live -= HDR(p)->size;
+   heap_live -= HDR(p)->size;
+}
+
+
+void *
+malloc_site(unsigned int size, char *file, unsigned line)
+{
+   void *p;
+   unsigned site = heap_site(file, line);
+
+   p = malloc(size);
+   if (p != NULL) {
+      heap_sites[site].allocs++;
+      heap_account_alloc(p, site);
+   }
+
+   return p;
+}
+
+
+void *
+realloc_site(void *ptr, unsigned int size, char *file, unsigned line)
+{
+   void *p;
+   unsigned site = heap_site(file, line);
+
+   if (ptr != NULL && HDR(ptr)->magic == MALLOC_MAGIC_USED) {
+      heap_account_free(ptr);
+      heap_sites[HDR(ptr)->site].frees--;
+   }
+
+   p = realloc(ptr, size);
+   if (p != NULL) {
+      heap_sites[site].reallocs++;
+      heap_account_alloc(p, site);
+   } else if (ptr != NULL) {
+      heap_account_alloc(ptr, HDR(ptr)->site);
+   }
+
+   return p;
+}
+
+
+void
+free_site(void *ptr, char *file, unsigned line)
+{
+   if (ptr != NULL && HDR(ptr)->magic == MALLOC_MAGIC_USED) {
+      heap_account_free(ptr);
+   }
+
+   free(ptr);
+}
+#endif /* CONFIG_HEAP_STATS */
+
+
+#if !defined(CONFIG_TINY) || defined(CONFIG_HEAP_STATS)
+void
+malloc_stats(void)
+{
+   unsigned i;
+   unsigned c;
+   length_t free_bytes = 0;
+   malloc_free_t *b;
+
+   for (c = 0; c < MALLOC_CLASSES; c++) {
+      for (b = small_free[c]; b != NULL; b = b->next) {
+         free_bytes += b->hdr.size;
+      }
+   }
+
+   for (b = large_free; b != NULL; b = b->next) {
+      free_bytes += b->hdr.size;
+   }
+
+   for (i = 0; i < region_count; i++) {
+      printk("Region %u: %p-%p\n", i, regions[i].base, regions[i].end);
+   }
+
+   printk("Heap 0x%x bytes, top 0x%x bytes free, lists 0x%x bytes free\n",
+          heap_size, malloc_end - malloc_ptr, free_bytes);
+   pool_stats();
+
+#ifdef CONFIG_HEAP_STATS
+   printk("Live 0x%x bytes, peak 0x%x bytes\n", heap_live, heap_peak);
+   for (i = 0; i < heap_site_count; i++) {
+      heap_site_t *s = &heap_sites[i];
+
+      if (s->allocs == 0 && s->reallocs == 0) {
+         continue;
+      }
+
+      printk("%s:%u: %u allocs, %u reallocs, %u frees, "
+             "live 0x%x, peak 0x%x\n", s->file, s->line,
+             s->allocs, s->reallocs, s->frees, s->live, s->peak);
+   }
+#endif /* CONFIG_HEAP_STATS */
+}
+
+
+static quik_err_t
+cmd_heap(char *args)
+{
+   malloc_stats();
+   return ERR_NONE;
+}
+
+COMMAND(heap, cmd_heap, "show heap usage");
+#endif /* !CONFIG_TINY || CONFIG_HEAP_STATS */
@@ -51,11 +51,11 @@ read_mac_partition(ihandle dev,
       return ERR_DEV_SHORT_READ;
    }
 
-   if (md->signature != MAC_DRIVER_MAGIC) {
+   if (be16_to_cpu(md->signature) != MAC_DRIVER_MAGIC) {
       return ERR_PART_NOT_MAC;
    }
 
-   secsize = md->block_size;
+   secsize = be16_to_cpu(md->block_size);
    blocks_in_map = 1;
    upart = 0;
    for (i = 1; i <= blocks_in_map; ++i) {
@@ -63,22 +63,22 @@ read_mac_partition(ihandle dev,
          return ERR_DEV_SHORT_READ;
       }
 
-      if (mp->signature != MAC_PARTITION_MAGIC) {
+      if (be16_to_cpu(mp->signature) != MAC_PARTITION_MAGIC) {
          break;
       }
 
       if (i == 1) {
-         blocks_in_map = mp->map_count;
+         blocks_in_map = be32_to_cpu(mp->map_count);
       }
 
       ++upart;
 
       /* If part is 0, use the first bootable partition. */
       if (part == upart
-          || (part == 0 && (mp->status & STATUS_BOOTABLE) != 0
+          || (part == 0 && (be32_to_cpu(mp->status) & STATUS_BOOTABLE) != 0
               && strcasecmp(mp->processor, "powerpc") == 0)) {
-         p->start = (offset_t) mp->start_block * (offset_t) secsize;
-         p->len = (offset_t) mp->block_count * (offset_t) secsize;
+         p->start = (offset_t) be32_to_cpu(mp->start_block) * (offset_t) secsize;
+         p->len = (offset_t) be32_to_cpu(mp->block_count) * (offset_t) secsize;
          p->dev = dev;
          return ERR_NONE;
       }
@@ -131,8 +131,8 @@ read_dos_partition(ihandle dev,
    }
 
    p->dev = dev;
-   p->start = swab32(d->start_sect) * SECTOR_SIZE;
-   p->len = swab32(d->nr_sects) * SECTOR_SIZE;
+   p->start = le32_to_cpu(d->start_sect) * SECTOR_SIZE;
+   p->len = le32_to_cpu(d->nr_sects) * SECTOR_SIZE;
    return ERR_NONE;
 }
 
@@ -0,0 +1,108 @@
+/*
+ * Fixed-size object pools, for the small structures that
+ * path lookups allocate and free all the time.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "quik.h"
+#include "pool.h"
+
+/*
+ * All pools that ever allocated anything, for pool_stats.
+ */
+static pool_t *pools = NULL;
+
+
+static quik_err_t
+pool_grow(pool_t *pool)
+{
+   unsigned i;
+   char *slab;
+   pool_obj_t *o;
+   length_t size = ALIGN_UP(pool->obj_size, sizeof(void *));
+
+   slab = malloc(size * pool->per_slab);
+   if (slab == NULL) {
+      return ERR_NO_MEM;
+   }
+
+   if (pool->slabs == 0) {
+      pool->next = pools;
+      pools = pool;
+   }
+
+   for (i = 0; i < pool->per_slab; i++) {
+      o = (pool_obj_t *) (slab + i * size);
+      o->next = pool->free_list;
+      pool->free_list = o;
+   }
+
+   pool->slabs++;
+   return ERR_NONE;
+}
+
+
+void *
+pool_alloc(pool_t *pool)
+{
+   pool_obj_t *o;
+
+   if (pool->free_list == NULL &&
+       pool_grow(pool) != ERR_NONE) {
+      return NULL;
+   }
+
+   o = pool->free_list;
+   pool->free_list = o->next;
+   pool->in_use++;
+   if (pool->in_use > pool->peak) {
+      pool->peak = pool->in_use;
+   }
+
+   return o;
+}
+
+
+void
+pool_free(pool_t *pool, void *obj)
+{
+   pool_obj_t *o = obj;
+
+   if (o == NULL) {
+      return;
+   }
+
+   o->next = pool->free_list;
+   pool->free_list = o;
+   pool->in_use--;
+}
+
+
+#if !defined(CONFIG_TINY) || defined(CONFIG_HEAP_STATS)
+void
+pool_stats(void)
+{
+   pool_t *p;
+
+   for (p = pools; p != NULL; p = p->next) {
+      printk("Pool %s: %u bytes x %u, %u in use, %u peak\n",
+             p->name, p->obj_size, p->slabs * p->per_slab,
+             p->in_use, p->peak);
+   }
+}
+#endif /* !CONFIG_TINY || CONFIG_HEAP_STATS */
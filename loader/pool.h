@@ -0,0 +1,52 @@
+/*
+ * Fixed-size object pools.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef QUIK_POOL_H
+#define QUIK_POOL_H
+
+#include "quik.h"
+
+typedef struct pool_obj {
+   struct pool_obj *next;
+} pool_obj_t;
+
+typedef struct pool {
+   char *name;
+   length_t obj_size;
+   unsigned per_slab;
+   pool_obj_t *free_list;
+   unsigned slabs;
+   unsigned in_use;
+   unsigned peak;
+   struct pool *next;
+} pool_t;
+
+/*
+ * Objects are carved from slabs of n objects each, which
+ * are malloc-ed as needed and never given back.
+ */
+#define POOL(var, type, n)                                       \
+   pool_t var = { .name = #type, .obj_size = sizeof(type), .per_slab = n }
+
+void *pool_alloc(pool_t *pool);
+void pool_free(pool_t *pool, void *obj);
+void pool_stats(void);
+
+#endif /* QUIK_POOL_H */
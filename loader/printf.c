@@ -153,6 +153,7 @@ void vprintk(char *fmt, va_list adx)
          printks(s);
       } else if (c == 'r') {
          err = va_arg(adx, quik_err_t);
+         prom_loud();
 #ifndef CONFIG_TINY
          printkr(err);
 #else
@@ -187,3 +188,18 @@ void printk(char *fmt,...)
    vprintk(fmt, x1);
    va_end(x1);
 }
+
+
+/*
+ * printk for errors, which reach the console even in quiet
+ * mode. Lines with a %r are treated the same way.
+ */
+void printk_err(char *fmt,...)
+{
+   va_list x1;
+
+   prom_loud();
+   va_start(x1, fmt);
+   vprintk(fmt, x1);
+   va_end(x1);
+}
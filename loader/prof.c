@@ -0,0 +1,276 @@
+/*
+ * Function-level profiling, for CONFIG_PROFILE builds.
+ *
+ * Everything is built with -finstrument-functions, and the hooks
+ * log function entries and exits with a timebase stamp into a
+ * ring. !prof replays the ring to get call counts and inclusive
+ * and exclusive time per function. Functions are shown by
+ * address, use addr2line -f -e iquik.elf to get names.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "quik.h"
+#include "prom.h"
+#include "commands.h"
+
+#ifdef CONFIG_TINY
+#error "CONFIG_PROFILE needs the timebase support left out by CONFIG_TINY"
+#endif /* CONFIG_TINY */
+
+#define NO_PROF __attribute__((no_instrument_function))
+
+/* Must be a power of two. */
+#define PROF_RING_SIZE 4096
+
+/* Deepest call chain tracked while replaying. */
+#define PROF_DEPTH 64
+
+/* Functions shown at most. */
+#define PROF_FUNCS 256
+
+/*
+ * Function addresses are word aligned, so the low
+ * bit tells entries from exits.
+ */
+#define PROF_EXIT 1
+
+typedef struct {
+   vaddr_t fn;
+   uint32_t tb;
+} prof_event_t;
+
+typedef struct {
+   vaddr_t fn;
+   unsigned calls;
+   uint32_t incl;
+   uint32_t excl;
+} prof_func_t;
+
+typedef struct {
+   vaddr_t fn;
+   uint32_t start;
+   uint32_t children;
+} prof_frame_t;
+
+static prof_event_t prof_ring[PROF_RING_SIZE];
+static unsigned prof_pos;
+static bool prof_off;
+
+/*
+ * 0 until known, then 1 for a 601 (no timebase,
+ * uses the RTC) or 2 for everything else.
+ */
+static unsigned prof_cpu;
+
+void __cyg_profile_func_enter(void *fn, void *site) NO_PROF;
+void __cyg_profile_func_exit(void *fn, void *site) NO_PROF;
+
+
+static uint32_t NO_PROF
+prof_ticks(void)
+{
+   uint32_t pvr;
+   uint32_t hi;
+   uint32_t lo;
+   uint32_t hi2;
+
+   if (prof_cpu == 0) {
+      __asm__ __volatile__("mfpvr %0" : "=r" (pvr));
+      prof_cpu = (pvr >> 16) == 1 ? 1 : 2;
+   }
+
+   /*
+    * Same units as prom_ticks().
+    */
+   if (prof_cpu == 1) {
+      do {
+         __asm__ __volatile__("mfspr %0,4" : "=r" (hi));
+         __asm__ __volatile__("mfspr %0,5" : "=r" (lo));
+         __asm__ __volatile__("mfspr %0,4" : "=r" (hi2));
+      } while (hi != hi2);
+
+      return hi * 1000000 + lo / 1000;
+   }
+
+   __asm__ __volatile__("mftb %0" : "=r" (lo));
+   return lo;
+}
+
+
+static void NO_PROF
+prof_log(vaddr_t fn)
+{
+   prof_event_t *e;
+
+   if (prof_off) {
+      return;
+   }
+
+   e = &prof_ring[prof_pos++ & (PROF_RING_SIZE - 1)];
+   e->fn = fn;
+   e->tb = prof_ticks();
+}
+
+
+void
+__cyg_profile_func_enter(void *fn,
+                         void *site)
+{
+   prof_log((vaddr_t) fn);
+}
+
+
+void
+__cyg_profile_func_exit(void *fn,
+                        void *site)
+{
+   prof_log((vaddr_t) fn | PROF_EXIT);
+}
+
+
+static prof_func_t *
+prof_func(prof_func_t *funcs,
+          unsigned *count,
+          vaddr_t fn)
+{
+   unsigned i;
+
+   for (i = 0; i < *count; i++) {
+      if (funcs[i].fn == fn) {
+         return &funcs[i];
+      }
+   }
+
+   if (*count == PROF_FUNCS) {
+      return NULL;
+   }
+
+   funcs[*count].fn = fn;
+   return &funcs[(*count)++];
+}
+
+
+static quik_err_t
+prof_dump(void)
+{
+   unsigned i;
+   unsigned j;
+   unsigned first;
+   unsigned depth = 0;
+   unsigned count = 0;
+   uint32_t incl;
+   prof_event_t *e;
+   prof_func_t *f;
+   prof_func_t tmp;
+   prof_func_t *funcs;
+   prof_frame_t *stack;
+
+   funcs = malloc(PROF_FUNCS * sizeof(prof_func_t));
+   stack = malloc(PROF_DEPTH * sizeof(prof_frame_t));
+   if (funcs == NULL || stack == NULL) {
+      free(funcs);
+      free(stack);
+      return ERR_NO_MEM;
+   }
+
+   memset(funcs, 0, PROF_FUNCS * sizeof(prof_func_t));
+   first = prof_pos > PROF_RING_SIZE ? prof_pos - PROF_RING_SIZE : 0;
+   for (i = first; i != prof_pos; i++) {
+      e = &prof_ring[i & (PROF_RING_SIZE - 1)];
+      if ((e->fn & PROF_EXIT) == 0) {
+         if (depth < PROF_DEPTH) {
+            stack[depth].fn = e->fn;
+            stack[depth].start = e->tb;
+            stack[depth].children = 0;
+         }
+
+         depth++;
+         continue;
+      }
+
+      /*
+       * Unwind past frames left by longjmp, and ignore exits
+       * whose entries fell out of the ring.
+       */
+      j = MIN(depth, PROF_DEPTH);
+      while (j != 0 && stack[j - 1].fn != (e->fn & ~PROF_EXIT)) {
+         j--;
+      }
+
+      if (j == 0) {
+         continue;
+      }
+
+      depth = j - 1;
+      incl = e->tb - stack[depth].start;
+      f = prof_func(funcs, &count, stack[depth].fn);
+      if (f != NULL) {
+         f->calls++;
+         f->incl += incl;
+         f->excl += incl - stack[depth].children;
+      }
+
+      if (depth != 0) {
+         stack[depth - 1].children += incl;
+      }
+   }
+
+   /*
+    * Most exclusive time first.
+    */
+   for (i = 1; i < count; i++) {
+      for (j = i; j > 0 && funcs[j - 1].excl < funcs[j].excl; j--) {
+         tmp = funcs[j];
+         funcs[j] = funcs[j - 1];
+         funcs[j - 1] = tmp;
+      }
+   }
+
+   printk("%u events, %u functions\n", prof_pos - first, count);
+   for (i = 0; i < count; i++) {
+      printk("%p: %u calls, %u us incl, %u us excl\n",
+             funcs[i].fn, funcs[i].calls,
+             prom_ticks_to_us(funcs[i].incl),
+             prom_ticks_to_us(funcs[i].excl));
+   }
+
+   free(funcs);
+   free(stack);
+   return ERR_NONE;
+}
+
+
+static quik_err_t
+cmd_prof(char *args)
+{
+   quik_err_t err = ERR_NONE;
+
+   prof_off = true;
+   if (!strcmp(args, "reset")) {
+      prof_pos = 0;
+   } else if (*args == '\0') {
+      err = prof_dump();
+   } else {
+      err = ERR_CMD_BAD_PARAM;
+   }
+
+   prof_off = false;
+   return err;
+}
+
+COMMAND(prof, cmd_prof, "show function profile, or reset it");
@@ -17,6 +17,9 @@
 
 #include "quik.h"
 #include "prom.h"
+#include "timing.h"
+#include "devtree.h"
+#include "trace.h"
 #include "commands.h"
 
 #define PROM_CLAIM_MAX_ADDR (0x10000000)
@@ -71,8 +74,12 @@ ihandle prom_memory;
 #define PROM_SMP_FIX                (1 << 6)
 #define PROM_SMP_PATH               "/PowerPC,604"
 
+/* Answer device tree queries from a snapshot when shimming. */
+#define PROM_DT_SNAPSHOT            (1 << 7)
+
 static unsigned prom_flags = 0;
 static struct prom_args prom_args;
+static vaddr_t prom_mem_top = 0;
 
 typedef struct of_shim_state {
    /*
@@ -90,6 +97,18 @@ static of_shim_state_t of_shim_state;
 
 void (*prom_entry)(void *);
 
+#ifdef CONFIG_HOST
+/* From the hosted build's OF emulator. */
+uint32_t host_mftb(void);
+#endif /* CONFIG_HOST */
+
+/*
+ * Cache block sizes, for string.S and cache.S. dcache_block
+ * is 0 until known, which keeps memset and memcpy off dcbz.
+ */
+uint32_t dcache_block;
+uint32_t icache_block;
+
 
 void
 prom_exit()
@@ -100,6 +119,7 @@ prom_exit()
     * TBD: Clean up opened handles.
     */
 
+   prom_flush();
    args.service = "exit";
    args.nargs = 0;
    args.nret = 0;
@@ -109,11 +129,222 @@ prom_exit()
 }
 
 
+#ifndef CONFIG_TINY
+/*
+ * Client interface accounting, per service and boot phase. All
+ * firmware calls funnel through the prom.c wrappers, so the boot
+ * phase says far more about who made a call than the caller does.
+ */
+#define PROM_STATS_MAX 64
+
+typedef struct {
+   char *service;
+   char *phase;
+   unsigned calls;
+   uint32_t us;
+} prom_stat_t;
+
+static prom_stat_t prom_stats[PROM_STATS_MAX];
+static unsigned prom_stats_count;
+#endif /* CONFIG_TINY */
+
+/*
+ * Timebase ticks per ms, or 0 if unknown. The 601 has no
+ * timebase, so its RTC is read and scaled to 1MHz instead.
+ */
+static uint32_t prom_tb_per_ms;
+static bool prom_tb_601;
+
+
+uint32_t
+prom_ticks(void)
+{
+#ifdef CONFIG_HOST
+   return host_mftb();
+#else
+   uint32_t hi;
+   uint32_t lo;
+   uint32_t hi2;
+
+   if (prom_tb_601) {
+      do {
+         __asm__ __volatile__("mfspr %0,4" : "=r" (hi));
+         __asm__ __volatile__("mfspr %0,5" : "=r" (lo));
+         __asm__ __volatile__("mfspr %0,4" : "=r" (hi2));
+      } while (hi != hi2);
+
+      return hi * 1000000 + lo / 1000;
+   }
+
+   __asm__ __volatile__("mftb %0" : "=r" (lo));
+   return lo;
+#endif /* CONFIG_HOST */
+}
+
+
+uint32_t
+prom_ticks_to_us(uint32_t ticks)
+{
+   if (prom_tb_per_ms == 0) {
+      return 0;
+   }
+
+   return (ticks / prom_tb_per_ms) * 1000 +
+      ((ticks % prom_tb_per_ms) * 1000) / prom_tb_per_ms;
+}
+
+
+/*
+ * Milliseconds for measuring short intervals, from the timebase
+ * where its rate is known, as asking OF is a lot slower. Wraps
+ * along with the timebase, so an interval spanning that looks
+ * longer than it was.
+ */
+uint32_t
+prom_ms(void)
+{
+   if (prom_tb_per_ms == 0) {
+      return get_ms();
+   }
+
+   return prom_ticks() / prom_tb_per_ms;
+}
+
+
+static void
+prom_find_timebase(void)
+{
+   uint32_t pvr;
+   uint32_t freq = 0;
+   ihandle cpu = 0;
+   phandle ph;
+
+#ifdef CONFIG_HOST
+   /*
+    * The OF emulator keeps a timebase, never a 601 RTC.
+    */
+   pvr = 0;
+#else
+   __asm__ __volatile__("mfpvr %0" : "=r" (pvr));
+#endif /* CONFIG_HOST */
+   if ((pvr >> 16) == 1) {
+      prom_tb_601 = true;
+      prom_tb_per_ms = 1000;
+      return;
+   }
+
+   if (prom_getprop(prom_chosen, "cpu", &cpu, sizeof(cpu)) <= 0) {
+      return;
+   }
+
+   ph = call_prom("instance-to-package", 1, 1, cpu);
+   if (ph == (phandle) -1 ||
+       prom_getprop(ph, "timebase-frequency", &freq, sizeof(freq)) <= 0) {
+      return;
+   }
+
+   prom_tb_per_ms = freq / 1000;
+}
+
+
+#ifndef CONFIG_TINY
+
+static void
+prom_account(char *service,
+             uint32_t ticks)
+{
+   unsigned i;
+   prom_stat_t *s;
+   char *phase = timing_phase();
+
+   for (i = 0; i < prom_stats_count; i++) {
+      s = &prom_stats[i];
+      if (s->phase == phase &&
+          (s->service == service || !strcmp(s->service, service))) {
+         break;
+      }
+   }
+
+   if (i == prom_stats_count) {
+      if (prom_stats_count == PROM_STATS_MAX) {
+         return;
+      }
+
+      s = &prom_stats[prom_stats_count++];
+      s->service = service;
+      s->phase = phase;
+   }
+
+   s->calls++;
+   s->us += prom_ticks_to_us(ticks);
+}
+
+
+static quik_err_t
+cmd_promstat(char *args)
+{
+   unsigned i;
+   unsigned j;
+   unsigned calls;
+   unsigned total = 0;
+   uint32_t us;
+
+   if (prom_tb_per_ms == 0) {
+      printk("No timebase frequency, times not known\n");
+   }
+
+   for (i = 0; i < prom_stats_count; i++) {
+
+      /*
+       * Each service once, at its first occurrence.
+       */
+      for (j = 0; j < i; j++) {
+         if (!strcmp(prom_stats[j].service, prom_stats[i].service)) {
+            break;
+         }
+      }
+
+      if (j != i) {
+         continue;
+      }
+
+      calls = 0;
+      us = 0;
+      for (j = i; j < prom_stats_count; j++) {
+         if (!strcmp(prom_stats[j].service, prom_stats[i].service)) {
+            calls += prom_stats[j].calls;
+            us += prom_stats[j].us;
+         }
+      }
+
+      printk("%s: %u calls, %u us\n", prom_stats[i].service, calls, us);
+      for (j = i; j < prom_stats_count; j++) {
+         if (!strcmp(prom_stats[j].service, prom_stats[i].service)) {
+            printk("   %s: %u calls, %u us\n", prom_stats[j].phase,
+                   prom_stats[j].calls, prom_stats[j].us);
+         }
+      }
+
+      total += calls;
+   }
+
+   printk("Total: %u calls\n", total);
+   return ERR_NONE;
+}
+
+COMMAND(promstat, cmd_promstat, "show OF client interface usage");
+#endif /* CONFIG_TINY */
+
+
 void *
 call_prom(char *service, int nargs, int nret, ...)
 {
    va_list list;
    int i;
+#ifndef CONFIG_TINY
+   uint32_t start;
+   uint32_t ticks;
+#endif /* CONFIG_TINY */
 
    prom_args.service = service;
    prom_args.nargs = nargs;
@@ -124,26 +355,124 @@ call_prom(char *service, int nargs, int nret, ...)
    va_end(list);
    for (i = 0; i < nret; ++i)
       prom_args.args[i + nargs] = 0;
+#ifndef CONFIG_TINY
+   start = prom_ticks();
    prom_entry(&prom_args);
+   ticks = prom_ticks() - start;
+   prom_account(service, ticks);
+   if (trace_on) {
+      trace_log(&prom_args, start, ticks);
+   }
+#else
+   prom_entry(&prom_args);
+#endif /* CONFIG_TINY */
    return prom_args.args[nargs];
 }
 
 
+/*
+ * Console output is line buffered, as every OF "write" is
+ * expensive on serial and OF 1.0.5 framebuffer consoles.
+ * The buffer is flushed on newline, before reading input
+ * and before leaving the loader.
+ */
+#define PROM_OUT_SIZE 256
+static char prom_out[PROM_OUT_SIZE];
+static unsigned prom_out_len;
+
+/*
+ * Everything printed also goes into a log ring, which is
+ * handed to the kernel as /chosen/iquik,boot-log. In quiet
+ * mode the console only sees lines marked loud (errors).
+ */
+#define PROM_LOG_SIZE 4096
+static char prom_log[PROM_LOG_SIZE];
+static unsigned prom_log_pos;
+static bool prom_quiet;
+static bool prom_out_loud;
+
+
+void
+prom_flush(void)
+{
+   if (prom_out_len != 0 && prom_stdout != NULL &&
+       (!prom_quiet || prom_out_loud)) {
+      call_prom("write", 3, 1, prom_stdout, prom_out, prom_out_len);
+   }
+
+   prom_out_len = 0;
+   prom_out_loud = false;
+}
+
+
+/*
+ * Make the current line show up even in quiet mode.
+ */
+void
+prom_loud(void)
+{
+   prom_out_loud = true;
+}
+
+
+/*
+ * Returns the previous setting.
+ */
+bool
+prom_set_quiet(bool quiet)
+{
+   bool old = prom_quiet;
+
+   prom_quiet = quiet;
+   return old;
+}
+
+
+void
+prom_export_log(void)
+{
+   char *buf;
+   unsigned i;
+   unsigned len;
+   unsigned start;
+
+   len = MIN(prom_log_pos, PROM_LOG_SIZE);
+   buf = malloc(len + 1);
+   if (buf == NULL) {
+      return;
+   }
+
+   /*
+    * Oldest character first. With a shallow setprop
+    * OF keeps the pointer, so buf is never freed.
+    */
+   start = prom_log_pos - len;
+   for (i = 0; i < len; i++) {
+      buf[i] = prom_log[(start + i) % PROM_LOG_SIZE];
+   }
+
+   buf[len] = '\0';
+   call_prom("setprop", 4, 1, prom_chosen, "iquik,boot-log",
+             buf, len + 1);
+}
+
+
+/*
+ * Return value n of the last call_prom(), for services
+ * like "call-method" that return more than one.
+ */
+void *
+prom_ret(int n)
+{
+   return prom_args.args[prom_args.nargs + n];
+}
+
+
 void
 prom_print(char *msg)
 {
-   char *p, *q;
-   char *crlf = "\r\n";
-
-   for (p = msg; *p != 0; p = q) {
-      for (q = p; *q != 0 && *q != '\n'; ++q)
-         ;
-      if (q > p)
-         call_prom("write", 3, 1, prom_stdout, p, q - p);
-      if (*q != 0) {
-         ++q;
-         call_prom("write", 3, 1, prom_stdout, crlf, 2);
-      }
+   while (*msg != '\0') {
+      putchar(*msg++);
    }
 }
 
@@ -151,15 +480,58 @@ prom_print(char *msg)
 int
 putchar(int c)
 {
-   char ch = c;
+   if (c != '\0') {
+      prom_log[prom_log_pos++ % PROM_LOG_SIZE] = c;
+   }
 
    if (prom_stdout == NULL) {
       return 0;
    }
 
-   if (c == '\n')
-      putchar('\r');
-   return (int) call_prom("write", 3, 1, prom_stdout, &ch, 1);
+   /*
+    * Leave room for the \r\n pair.
+    */
+   if (prom_out_len >= PROM_OUT_SIZE - 1) {
+      prom_flush();
+   }
+
+   if (c == '\n') {
+      prom_out[prom_out_len++] = '\r';
+   }
+
+   prom_out[prom_out_len++] = c;
+   if (c == '\n') {
+      prom_flush();
+   }
+
+   return 1;
+}
+
+
+/*
+ * Keys typed while a load was going on, see task_yield.
+ */
+#define TYPEAHEAD_SIZE 16
+static char typeahead[TYPEAHEAD_SIZE];
+static unsigned typeahead_count;
+
+
+void
+prom_typeahead(key_t c)
+{
+   if (typeahead_count < TYPEAHEAD_SIZE) {
+      typeahead[typeahead_count++] = c;
+   }
+}
+
+
+static key_t
+typeahead_next(void)
+{
+   key_t c = typeahead[0];
+
+   memmove(typeahead, typeahead + 1, --typeahead_count);
+   return c;
 }
 
 
@@ -173,6 +545,15 @@ getchar()
       return -1;
    }
 
+   /*
+    * Someone is typing, so they should see the output.
+    */
+   prom_quiet = false;
+   prom_flush();
+   if (typeahead_count != 0) {
+      return typeahead_next();
+   }
+
    while ((r = (int) call_prom("read", 3, 1, prom_stdin, &ch, 1)) == 0)
       ;
    return r > 0? ch: KEY_NONE;
@@ -181,93 +562,254 @@ getchar()
 
 int
 nbgetchar()
+{
+   if (prom_stdin == NULL) {
+      return -1;
+   }
+
+   prom_flush();
+   if (typeahead_count != 0) {
+      return typeahead_next();
+   }
+
+   return prom_poll_key();
+}
+
+
+/*
+ * Reads a key if there is one, skipping the typeahead
+ * and leaving the output alone.
+ */
+key_t
+prom_poll_key(void)
 {
    char ch;
 
    if (prom_stdin == NULL) {
-      return -1;
+      return KEY_NONE;
    }
 
    return (int) call_prom("read", 3, 1, prom_stdin, &ch, 1) > 0? ch: KEY_NONE;
 }
 
 
-static void
-prom_shim(struct prom_args *args)
+/*
+ * Node hidden from the kernel, if any.
+ */
+phandle
+prom_shim_hidden(void)
 {
-   if (strcmp(args->service, "getprop") == 0) {
-      phandle ph = (phandle) args->args[0];
-      char *name = (char *) args->args[1];
-      uint32_t *place = (uint32_t *) args->args[2];
-      uint32_t size = (uint32_t) args->args[3];
-      uint32_t *ret = (uint32_t *) &args->args[4];
-
-      if (prom_flags & PROM_SMP_FIX &&
-          ph == of_shim_state.cpu) {
-         unsigned index = 0;
-         if (strcmp(name, "reg") != 0) {
-            goto out;
-         }
+   if (prom_flags & PROM_3400_HIDE_MEDIABAY_ATA) {
+      return of_shim_state.mediabay_ata;
+   }
 
-         size = MIN(of_shim_state.cpu_count, size);
-         *ret = size;
-         while (size) {
-            *place = index++;
-            size -= 4;
-            place++;
-         }
+   return 0;
+}
 
-         return;
-      } else if (prom_flags & PROM_SHALLOW_SETPROP &&
-                 ph == prom_chosen) {
-        /*
-         * Linux kernels expect setprop to be deep, so
-         * the address passed can sometimes be on the stack,
-         * and initrd-start is one such affected variable,
-         * sadly enough.
-         */
-         if (strcmp(name, "linux,initrd-start") == 0) {
-            if (size == 8) {
-               *place++ = 0;
-            }
-
-            *place = (uint32_t) bi->initrd_base;
-         } else if (strcmp(name, "linux,initrd-end") == 0) {
-           if (size == 8) {
-              *place++ = 0;
-           }
-
-           *place = (uint32_t) bi->initrd_base +
-              bi->initrd_len;
-         } else {
-            goto out;
-         }
 
-         *ret = size;
-         return;
+/*
+ * Fix up a property value as the kernel should see it.
+ */
+void
+prom_shim_fixup(phandle ph,
+                char *name,
+                void *value,
+                length_t len)
+{
+   unsigned index = 0;
+   uint32_t *place = value;
+
+   if (prom_flags & PROM_SMP_FIX &&
+       ph == of_shim_state.cpu &&
+       strcmp(name, "reg") == 0) {
+      len = MIN(of_shim_state.cpu_count, len);
+      while (len >= 4) {
+         *place++ = index++;
+         len -= 4;
       }
    }
+}
 
-   if (prom_flags & PROM_3400_HIDE_MEDIABAY_ATA) {
-      if (strcmp(args->service, "child") == 0 ||
-          strcmp(args->service, "peer") == 0 ||
-          strcmp(args->service, "parent") == 0) {
-         prom_entry(args);
-         if (args->args[args->nargs] ==
-             of_shim_state.mediabay_ata) {
-            args->args[args->nargs] = 0;
+
+bool
+prom_shim_snapshot(void)
+{
+   return (prom_flags & PROM_DT_SNAPSHOT) != 0;
+}
+
+
+/*
+ * Shim handlers return true if they fully handled the call,
+ * or false to have it passed on to OF.
+ */
+typedef bool (*shim_handler_t)(struct prom_args *args);
+
+
+static bool
+shim_getprop(struct prom_args *args)
+{
+   phandle ph = (phandle) args->args[0];
+   char *name = (char *) args->args[1];
+   uint32_t *place = (uint32_t *) args->args[2];
+   uint32_t size = (uint32_t) args->args[3];
+   uint32_t *ret = (uint32_t *) &args->args[4];
+
+   if (prom_flags & PROM_SMP_FIX &&
+       ph == of_shim_state.cpu &&
+       strcmp(name, "reg") == 0) {
+      size = MIN(of_shim_state.cpu_count, size);
+      *ret = size;
+      prom_shim_fixup(ph, name, place, size);
+      return true;
+   } else if (prom_flags & PROM_SHALLOW_SETPROP &&
+              ph == prom_chosen) {
+     /*
+      * Linux kernels expect setprop to be deep, so
+      * the address passed can sometimes be on the stack,
+      * and initrd-start is one such affected variable,
+      * sadly enough.
+      */
+      if (strcmp(name, "linux,initrd-start") == 0) {
+         if (size == 8) {
+            *place++ = 0;
          }
 
-         return;
+         *place = (uint32_t) bi->initrd_base;
+      } else if (strcmp(name, "linux,initrd-end") == 0) {
+        if (size == 8) {
+           *place++ = 0;
+        }
+
+        *place = (uint32_t) bi->initrd_base +
+           bi->initrd_len;
+      } else {
+         return false;
       }
+
+      *ret = size;
+      return true;
    }
 
+   return devtree_shim_getprop(args);
+}
+
+
+/*
+ * For child, peer and parent, when not answered
+ * from the snapshot.
+ */
+static bool
+shim_walk(struct prom_args *args)
+{
+   if ((prom_flags & PROM_3400_HIDE_MEDIABAY_ATA) == 0) {
+      return false;
+   }
+
+   prom_entry(args);
+   if (args->args[args->nargs] ==
+       of_shim_state.mediabay_ata) {
+      args->args[args->nargs] = 0;
+   }
+
+   return true;
+}
+
+
+static bool
+shim_child(struct prom_args *args)
+{
+   return devtree_shim_child(args) || shim_walk(args);
+}
+
+
+static bool
+shim_peer(struct prom_args *args)
+{
+   return devtree_shim_peer(args) || shim_walk(args);
+}
+
+
+static bool
+shim_parent(struct prom_args *args)
+{
+   return devtree_shim_parent(args) || shim_walk(args);
+}
+
+
+static bool
+shim_quiesce(struct prom_args *args)
+{
    if (bi->flags & DEBUG_BEFORE_BOOT) {
-      if (strcmp(args->service, "quiesce") == 0) {
-         prom_pause(NULL);
+      prom_pause(NULL);
+   }
+
+   return false;
+}
+
+
+static struct {
+   char *service;
+   shim_handler_t handler;
+} shim_handlers[] = {
+   { "getprop", shim_getprop },
+   { "getproplen", devtree_shim_getproplen },
+   { "nextprop", devtree_shim_nextprop },
+   { "setprop", devtree_shim_setprop },
+   { "child", shim_child },
+   { "peer", shim_peer },
+   { "parent", shim_parent },
+   { "quiesce", shim_quiesce },
+};
+
+/*
+ * The kernel passes service names as string literals, so the
+ * same name always comes at the same address. Remember which
+ * handler, if any, each address maps to, so that most calls
+ * cost a pointer compare rather than a round of strcmp().
+ */
+#define SHIM_CACHE_SIZE 32
+#define SHIM_CACHE_HASH(s) \
+   ((((vaddr_t) (s)) ^ (((vaddr_t) (s)) >> 5)) & (SHIM_CACHE_SIZE - 1))
+
+static struct {
+   char *service;
+   shim_handler_t handler;
+} shim_cache[SHIM_CACHE_SIZE];
+
+
+static shim_handler_t
+shim_lookup(char *service)
+{
+   unsigned i;
+   unsigned slot = SHIM_CACHE_HASH(service);
+   shim_handler_t handler = NULL;
+
+   if (shim_cache[slot].service == service) {
+      return shim_cache[slot].handler;
+   }
+
+   for (i = 0; i < sizeof(shim_handlers) / sizeof(shim_handlers[0]); i++) {
+      if (strcmp(service, shim_handlers[i].service) == 0) {
+         handler = shim_handlers[i].handler;
+         break;
       }
    }
-out:
+
+   shim_cache[slot].service = service;
+   shim_cache[slot].handler = handler;
+   return handler;
+}
+
+
+static void
+prom_shim(struct prom_args *args)
+{
+   shim_handler_t handler = shim_lookup(args->service);
+
+   if (handler != NULL && handler(args)) {
+      return;
+   }
+
    prom_entry(args);
 }
 
@@ -329,6 +871,113 @@ parse_prom_flags(void)
 }
 
 
+/*
+ * Every CPU an OldWorld can have uses 32-byte blocks, so that's
+ * assumed if the cpu node doesn't say.
+ */
+static void
+prom_find_cache_blocks(void)
+{
+   ihandle cpu = 0;
+   phandle ph = (phandle) -1;
+   uint32_t block = DCACHE_BLOCK_DEFAULT;
+
+   icache_block = ICACHE_BLOCK_DEFAULT;
+   if (prom_getprop(prom_chosen, "cpu", &cpu, sizeof(cpu)) > 0) {
+      ph = call_prom("instance-to-package", 1, 1, cpu);
+   }
+
+   if (ph != (phandle) -1) {
+      (void) prom_getprop(ph, "d-cache-block-size",
+                          &block, sizeof(block));
+      (void) prom_getprop(ph, "i-cache-block-size",
+                          &icache_block, sizeof(icache_block));
+   }
+
+   /*
+    * flush_cache needs something sane to step by.
+    */
+   if (icache_block < 16 || icache_block > 4096 ||
+       (icache_block & (icache_block - 1)) != 0) {
+      icache_block = ICACHE_BLOCK_DEFAULT;
+   }
+
+   /*
+    * string.S copies 16 bytes at a time and needs
+    * a power of two.
+    */
+   if (block < 16 || block > 4096 || (block & (block - 1)) != 0) {
+      return;
+   }
+
+   dcache_block = block;
+}
+
+
+/*
+ * Figure out where RAM starting at 0 ends, assuming
+ * one address and one size cell, as on all PowerMacs.
+ */
+static void
+prom_find_mem_top(void)
+{
+   int len;
+   unsigned i;
+   phandle mem;
+   uint32_t reg[16];
+
+   prom_mem_top = 0;
+   mem = call_prom("finddevice", 1, 1, "/memory");
+   if (mem == (phandle) -1) {
+      return;
+   }
+
+   len = prom_getprop(mem, "reg", reg, sizeof(reg));
+   if (len <= 0) {
+      return;
+   }
+
+   len = MIN(len, sizeof(reg)) / sizeof(uint32_t);
+   for (i = 0; i + 1 < len; i += 2) {
+      if (reg[i] != prom_mem_top) {
+         break;
+      }
+
+      prom_mem_top += reg[i + 1];
+   }
+
+   if (prom_mem_top > PROM_CLAIM_MAX_ADDR) {
+      prom_mem_top = PROM_CLAIM_MAX_ADDR;
+   }
+}
+
+
+/*
+ * Look for a word in /chosen/bootargs, for settings like "quiet"
+ * that have to be known before env_init, so that even the first
+ * messages stay off the console.
+ */
+bool
+prom_bootargs_has(char *word)
+{
+   char args[256];
+   char *p;
+   char *q;
+   unsigned len = strlen(word);
+
+   prom_get_chosen("bootargs", args, sizeof(args) - 1);
+   args[sizeof(args) - 1] = '\0';
+   for (p = args; (q = strstr(p, word)) != NULL; p = q + len) {
+      if ((q == args || q[-1] == ' ') &&
+          (q[len] == '\0' || q[len] == ' ')) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
 quik_err_t
 prom_init(void (*pp)(void *))
 {
@@ -339,6 +988,7 @@ prom_init(void (*pp)(void *))
    prom_entry = pp;
    bi->prom_entry  = (vaddr_t) pp;
    bi->prom_shim = (vaddr_t) prom_shim;
+   timing_mark("prom_init");
 
    prom_root = call_prom("finddevice", 1, 1, "/");
    if (prom_root == (phandle) -1) {
@@ -351,8 +1001,12 @@ prom_init(void (*pp)(void *))
       return ERR_OF_INIT_NO_CHOSEN;
    }
 
+   prom_find_timebase();
+   prom_find_cache_blocks();
+
    (void) prom_getprop(prom_chosen, "stdout", &prom_stdout, sizeof(prom_stdout));
    (void) prom_getprop(prom_chosen, "stdin", &prom_stdin, sizeof(prom_stdin));
+   prom_quiet = prom_bootargs_has("quiet");
    printk("\n");
 
    prom_options = call_prom("finddevice", 1, 1, "/options");
@@ -375,6 +1029,7 @@ prom_init(void (*pp)(void *))
        * Not verified, but likely broken as well.
        */
       prom_flags |= PROM_SHALLOW_SETPROP;
+      prom_flags |= PROM_DT_SNAPSHOT;
    } else if (strcmp(ver, OF_VER_20) == 0 ||
               (strcmp(ver, OF_VER_201) == 0)) {
       /*
@@ -382,6 +1037,7 @@ prom_init(void (*pp)(void *))
        * Possibly older than Wallstreet systems are affected.
        */
       prom_flags |= PROM_SHALLOW_SETPROP;
+      prom_flags |= PROM_DT_SNAPSHOT;
    } else if (strcmp(ver, OF_VER_3) == 0 ||
               strcmp(ver, OF_VER_NW)) {
       /*
@@ -404,6 +1060,8 @@ prom_init(void (*pp)(void *))
       prom_flags |= PROM_SMP_FIX;
    }
 
+   prom_find_mem_top();
+
    err = parse_prom_flags();
    if (err != ERR_NONE) {
       return err;
@@ -411,6 +1069,7 @@ prom_init(void (*pp)(void *))
 
    /* Run the preboot script if there is one. */
    if (strlen(preboot_script) != 0) {
+      timing_mark("preboot");
       printk("\nPress any key in %u secs to skip preboot script ... ",
              TIMEOUT_TO_SECS(PREBOOT_TIMEOUT));
       if (wait_for_key(PREBOOT_TIMEOUT, KEY_NONE) == KEY_NONE) {
@@ -460,7 +1119,9 @@ prom_pause(char *message)
       message = "Type go<return> to continue.\n";
    }
 
+   prom_quiet = false;
    printk("%s", message);
+   prom_flush();
    call_prom("enter", 0, 0);
    printk("\n");
 }
@@ -469,6 +1130,8 @@ prom_pause(char *message)
 void
 prom_interpret(char *buf)
 {
+  prom_flush();
+  devtree_invalidate();
   call_prom("interpret", 1, 1, buf);
 }
 
@@ -547,9 +1210,37 @@ prom_claim_chunk(void *virt,
 {
   void *found, *addr;
 
-  for (addr = (void *) ALIGN_UP((unsigned) virt, SIZE_1M);
+  for (addr = (void *) ALIGN_UP((vaddr_t) virt, SIZE_1M);
        addr <= (void*) PROM_CLAIM_MAX_ADDR;
-       addr = (void *) ((unsigned) addr + SIZE_1M)) {
+       addr = (void *) ((vaddr_t) addr + SIZE_1M)) {
+     found = prom_claim(addr, size);
+     if (found != (void *)-1) {
+        return found;
+     }
+  }
+
+  return (void*) -1;
+}
+
+
+/*
+ * Like prom_claim_chunk, but search from the top of
+ * RAM down to floor, so as to stay away from the
+ * LOAD_BASE claims.
+ */
+void *
+prom_claim_chunk_high(void *floor,
+                      unsigned int size)
+{
+  void *found, *addr;
+
+  if (prom_mem_top < (vaddr_t) floor + size) {
+     return (void *) -1;
+  }
+
+  for (addr = (void *) ALIGN(prom_mem_top - size + 1, SIZE_1M);
+       addr >= floor;
+       addr = (void *) ((vaddr_t) addr - SIZE_1M)) {
      found = prom_claim(addr, size);
      if (found != (void *)-1) {
         return found;
@@ -21,23 +21,39 @@ extern ihandle prom_aliases;
 quik_err_t prom_init(void (*pp)(void *));
 void prom_exit(void);
 void *call_prom(char *service, int nargs, int nret, ...);
+void *prom_ret(int n);
+void prom_flush(void);
+void prom_loud(void);
+bool prom_set_quiet(bool quiet);
+void prom_export_log(void);
 void prom_print(char *msg);
 int putchar(int c);
 key_t getchar(void);
 key_t nbgetchar(void);
+key_t prom_poll_key(void);
+void prom_typeahead(key_t c);
 void prom_get_chosen(char *name, char *buf, int buflen);
 void prom_get_options(char *name, char *buf, int buflen);
 void prom_map(unsigned char *addr, unsigned len);
 int get_ms(void);
+uint32_t prom_ticks(void);
+uint32_t prom_ticks_to_us(uint32_t ticks);
+uint32_t prom_ms(void);
 void prom_pause(char *message);
 void prom_interpret(char *buf);
 void prom_ensure_claimed(void *virt, unsigned int size);
 void prom_release(void *virt, unsigned int size);
 void *prom_claim_chunk(void *virt,
                        unsigned int size);
+void *prom_claim_chunk_high(void *floor,
+                            unsigned int size);
 void *prom_claim(void *virt, unsigned int size);
 quik_err_t prom_open(char *device, ihandle *ih);
 void set_bootargs(char *params);
+bool prom_bootargs_has(char *word);
+phandle prom_shim_hidden(void);
+void prom_shim_fixup(phandle ph, char *name, void *value, length_t len);
+bool prom_shim_snapshot(void);
 
 struct prom_args {
    char *service;
@@ -25,6 +25,7 @@
 #include <inttypes.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <bootconf.h>
 
 #define ALIGN_UP(addr, align) (((addr) + (align) - 1) & (~((align) - 1)))
 #define ALIGN(addr, align) (((addr) - 1) & (~((align) - 1)))
@@ -33,7 +34,14 @@
 #define SIZE_4K 0x1000
 #define NULL ((void *) 0)
 
+#ifdef CONFIG_HOST
+/*
+ * The hosted build (see host/) can be 64-bit.
+ */
+typedef uintptr_t vaddr_t;
+#else
 typedef uint32_t vaddr_t;
+#endif /* CONFIG_HOST */
 typedef uint64_t offset_t;
 typedef uint32_t length_t;
 
@@ -56,12 +64,16 @@ typedef struct {
   vaddr_t linked_base;
   vaddr_t text_offset;
   length_t text_len;
+  /* Executable part of text, as an offset from linked_base. */
+  vaddr_t exec_offset;
+  length_t exec_len;
   vaddr_t  entry;
 } load_state_t;
 
 #define QUIK_ERR_LIST                                                   \
    QUIK_ERR_DEF(ERR_NONE, "no error")                                   \
    QUIK_ERR_DEF(ERR_NOT_READY, "operation should be retried")           \
+   QUIK_ERR_DEF(ERR_ABORTED, "aborted")                                 \
    QUIK_ERR_DEF(ERR_MALLOC_INIT, "malloc claim failed")                \
    QUIK_ERR_DEF(ERR_OF_INIT_NO_CHOSEN, "no OF /chosen")                 \
    QUIK_ERR_DEF(ERR_OF_INIT_NO_MEMORY, "no OF /memory")                 \
@@ -69,6 +81,7 @@ typedef struct {
    QUIK_ERR_DEF(ERR_OF_INIT_NO_OPROM, "no OF /openprom")                \
    QUIK_ERR_DEF(ERR_OF_INIT_NO_ROOT, "no OF /")                         \
    QUIK_ERR_DEF(ERR_OF_OPEN, "cannot open device")                      \
+   QUIK_ERR_DEF(ERR_OF_METHOD, "OF method call failed")                 \
    QUIK_ERR_DEF(ERR_DEV_SHORT_READ, "short read on device")             \
    QUIK_ERR_DEF(ERR_PART_NOT_MAC, "partitioning not macintosh")         \
    QUIK_ERR_DEF(ERR_PART_NOT_DOS, "partitioning not dos")               \
@@ -83,6 +96,7 @@ typedef struct {
    QUIK_ERR_DEF(ERR_FS_NOT_EXT2, "FS is not ext2")                      \
    QUIK_ERR_DEF(ERR_FS_CORRUPT, "FS is corrupted")                      \
    QUIK_ERR_DEF(ERR_FS_LOOP, "symlink loop detected")                   \
+   QUIK_ERR_DEF(ERR_FS_PIN_STALE, "file changed since it was pinned")    \
    QUIK_ERR_DEF(ERR_ELF_NOT, "invalid kernel image")                    \
    QUIK_ERR_DEF(ERR_ELF_WRONG, "invalid kernel architecture")           \
    QUIK_ERR_DEF(ERR_ELF_NOT_LOADABLE, "not a loadable image")           \
@@ -90,6 +104,8 @@ typedef struct {
    QUIK_ERR_DEF(ERR_KERNEL_OLD_BIG, "pre-2.4 kernel too large ")        \
    QUIK_ERR_DEF(ERR_NO_MEM, "malloc failed")                            \
    QUIK_ERR_DEF(ERR_CONFIG_NOT_FOUND, "no configuration file found")    \
+   QUIK_ERR_DEF(ERR_CONFIG_STALE, "compiled configuration is stale")    \
+   QUIK_ERR_DEF(ERR_CONFIG_BAD, "compiled configuration is invalid")    \
    QUIK_ERR_DEF(ERR_ENV_DEFAULT_BAD, "bad default device path")         \
    QUIK_ERR_DEF(ERR_ENV_CURRENT_BAD, "bad current device path")         \
    QUIK_ERR_DEF(ERR_ENV_PREBOOT_BAD, "no boot-file set by preboot script") \
@@ -125,6 +141,9 @@ typedef struct {
 #define SHIM_OF               (1 << 6)
 #define WITH_PREBOOT          (1 << 7)
 #define HAVE_IMAGES           (1 << 8)
+#define SHOW_PROGRESS         (1 << 9)
+#define CONFIG_FILE_GIVEN     (1 << 10)
+#define BACKGROUND_IO         (1 << 11)
    unsigned flags;
 
    /* Config file path. E.g. /etc/quik.conf */
@@ -159,6 +178,8 @@ extern boot_info_t *bi;
 
 typedef int key_t;
 #define KEY_NONE (-1)
+#define KEY_CTRL_C 0x03
+#define KEY_ESC 0x1b
 
 #define DEFAULT_TIMEOUT -1
 #define PREBOOT_TIMEOUT 50
@@ -167,17 +188,25 @@ typedef int key_t;
 quik_err_t elf_parse(void *load_buf,
                      length_t load_buf_len,
                      load_state_t *image);
+length_t elf_mem_len(void *load_buf,
+                     length_t load_buf_len);
 quik_err_t elf_relo(load_state_t *image);
 quik_err_t elf_boot(load_state_t *image,
                     char *params);
 
 int cfg_parse(char *cfg_file, char *buff, int len);
-char *cfg_get_strg(char *image, char *item);
-int cfg_get_flag(char *image, char *item);
+bootconf_t *cfg_compiled(void);
+int cfg_parse_compiled(bootconf_t *bc);
+bootconf_file_t *cfg_pinned(char *path, uint8_t *uuid,
+                            bootconf_extent_t **extents);
+char *cfg_get_strg(char *label, cfg_item_t item);
+int cfg_get_flag(char *label, cfg_item_t item);
 void cfg_print_images(void);
 char *cfg_get_default(void);
 
 quik_err_t malloc_init(void);
+length_t malloc_heap_size(void);
+void malloc_stats(void);
 void *malloc(unsigned int size);
 void free(void *);
 void *realloc(void *ptr, unsigned int size);
@@ -187,10 +216,16 @@ quik_err_t env_dev_update_from_default(env_dev_t *cur_dev);
 quik_err_t env_dev_is_valid(env_dev_t *dp);
 quik_err_t env_init(void);
 
-void spinner(int freq);
+void spinner(void);
 void flush_cache(vaddr_t base, length_t len);
+
+#define DCACHE_BLOCK_DEFAULT 32
+#define ICACHE_BLOCK_DEFAULT 32
+extern uint32_t dcache_block;
+extern uint32_t icache_block;
 void vprintk(char *fmt, va_list adx);
 void printk(char *fmt, ...);
+void printk_err(char *fmt, ...);
 
 typedef struct {
    unsigned count;
@@ -203,6 +238,23 @@ void table_print_end(table_print_t *t);
 
 uint32_t swab32(uint32_t value);
 uint16_t swab16(uint16_t value);
+
+/*
+ * Mac partition maps and ELF headers are big-endian, ext2 and PC
+ * partition tables little-endian. The loader itself always runs
+ * big-endian, but the hosted build (see host/) usually doesn't.
+ */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define be16_to_cpu(x) swab16(x)
+#define be32_to_cpu(x) swab32(x)
+#define le16_to_cpu(x) (x)
+#define le32_to_cpu(x) (x)
+#else
+#define be16_to_cpu(x) (x)
+#define be32_to_cpu(x) (x)
+#define le16_to_cpu(x) swab16(x)
+#define le32_to_cpu(x) swab32(x)
+#endif
 char *strstr(const char *s1, const char *s2);
 char *strcpy(char *dest, const char *src);
 char *strncpy(char *dest, const char *src, length_t n);
@@ -229,4 +281,19 @@ void word_split(char **linep,
 key_t wait_for_key(int timeout,
                    key_t timeout_key);
 
+#ifdef CONFIG_HEAP_STATS
+/*
+ * Account every allocation to the file and line it was made
+ * from, see !heap.
+ */
+void *malloc_site(unsigned int size, char *file, unsigned line);
+void *realloc_site(void *ptr, unsigned int size, char *file, unsigned line);
+void free_site(void *ptr, char *file, unsigned line);
+void *strdup_site(char *str, char *file, unsigned line);
+#define malloc(size) malloc_site((size), __FILE__, __LINE__)
+#define realloc(ptr, size) realloc_site((ptr), (size), __FILE__, __LINE__)
+#define free(ptr) free_site((ptr), __FILE__, __LINE__)
+#define strdup(str) strdup_site((str), __FILE__, __LINE__)
+#endif /* CONFIG_HEAP_STATS */
+
 #endif /* QUIK_QUIK_H */
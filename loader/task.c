@@ -0,0 +1,170 @@
+/*
+ * Cooperative background tasks.
+ *
+ * Tasks are resumable bits of work, like walking the device tree
+ * or reading ahead the default image, each done a step at a time.
+ * They run while the loader waits for a key, and those that don't
+ * touch the file layer also run between the blocks of a load,
+ * which is also when the keyboard is checked for an abort.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "quik.h"
+#include "prom.h"
+#include "task.h"
+
+static task_t *tasks;
+static uint32_t last_yield;
+
+
+void
+task_start(task_t *task)
+{
+   task_t **p;
+
+   if (task->queued) {
+      return;
+   }
+
+   for (p = &tasks; *p != NULL; p = &(*p)->next)
+      ;
+
+   task->next = NULL;
+   task->queued = true;
+   *p = task;
+}
+
+
+/*
+ * Leaves task->next alone, so that task_run can carry on
+ * past a task stopped under it.
+ */
+void
+task_stop(task_t *task)
+{
+   task_t **p;
+
+   for (p = &tasks; *p != NULL; p = &(*p)->next) {
+      if (*p == task) {
+         *p = task->next;
+         break;
+      }
+   }
+
+   task->queued = false;
+}
+
+
+/*
+ * Steps every queued task not marked skip in turn, until
+ * ms have passed or none are left. A pass is always made.
+ */
+static void
+task_run(unsigned skip,
+         uint32_t ms)
+{
+   task_t *t;
+   bool ran;
+   uint32_t start = prom_ms();
+
+   do {
+      ran = false;
+      for (t = tasks; t != NULL; t = t->next) {
+         if (!t->queued || (t->flags & skip) != 0) {
+            continue;
+         }
+
+         ran = true;
+         if (!t->step()) {
+            task_stop(t);
+         }
+      }
+   } while (ran && prom_ms() - start < ms);
+}
+
+
+/*
+ * Called while waiting for input.
+ */
+void
+task_idle(void)
+{
+   task_run(0, TASK_SLICE_MS);
+}
+
+
+/*
+ * getchar, running tasks until a key comes.
+ */
+key_t
+task_getchar(void)
+{
+   key_t c;
+
+   if (prom_stdin == NULL) {
+      return KEY_NONE;
+   }
+
+   /*
+    * Someone is typing, so they should see the output.
+    */
+   prom_set_quiet(false);
+   while ((c = nbgetchar()) == KEY_NONE) {
+      task_idle();
+   }
+
+   return c;
+}
+
+
+/*
+ * Called between the blocks of a load. Every TASK_SLICE_MS,
+ * lets the tasks that can run beside it take a step, and
+ * checks the keyboard. ESC or Ctrl-C aborts the load, while
+ * anything else is kept for the prompt.
+ */
+quik_err_t
+task_yield(void)
+{
+   key_t c;
+   uint32_t now;
+
+   /*
+    * A task's own reads.
+    */
+   if (bi->flags & BACKGROUND_IO) {
+      return ERR_NONE;
+   }
+
+   now = prom_ms();
+   if (now - last_yield < TASK_SLICE_MS) {
+      return ERR_NONE;
+   }
+
+   last_yield = now;
+   task_run(TASK_IDLE_ONLY, 0);
+
+   c = prom_poll_key();
+   if (c == KEY_ESC || c == KEY_CTRL_C) {
+      return ERR_ABORTED;
+   } else if (c != KEY_NONE) {
+      prom_typeahead(c);
+   }
+
+   return ERR_NONE;
+}
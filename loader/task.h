@@ -0,0 +1,53 @@
+/*
+ * Cooperative background tasks.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef QUIK_TASK_H
+#define QUIK_TASK_H
+
+#include "quik.h"
+
+/*
+ * How long tasks get to run, and how long a load goes,
+ * before the keyboard is looked at again.
+ */
+#define TASK_SLICE_MS 20
+
+/*
+ * Uses the file layer, so only runs while waiting for input.
+ */
+#define TASK_IDLE_ONLY (1 << 0)
+
+typedef struct task {
+   /*
+    * Does a bit of work, returning false once there's no more.
+    */
+   bool (*step)(void);
+   unsigned flags;
+   bool queued;
+   struct task *next;
+} task_t;
+
+void task_start(task_t *task);
+void task_stop(task_t *task);
+void task_idle(void);
+key_t task_getchar(void);
+quik_err_t task_yield(void);
+
+#endif /* QUIK_TASK_H */
@@ -0,0 +1,162 @@
+/*
+ * Boot phase timing.
+ *
+ * Phases are strictly sequential: each mark ends the phase
+ * before it, and a NULL mark just ends the current one. Times
+ * come from the OF "milliseconds" service, as 601 CPUs don't
+ * have a timebase.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "quik.h"
+#include "prom.h"
+#include "timing.h"
+#include "commands.h"
+
+#define TIMING_PHASES 24
+
+typedef struct {
+   char *name;
+   int start;
+   int len;
+} phase_t;
+
+static phase_t phases[TIMING_PHASES];
+static unsigned phase_count;
+static bool phase_open;
+static int timing_base;
+static char *phase_current = "other";
+
+
+/*
+ * Name of the phase in progress, for attributing
+ * things to phases.
+ */
+char *
+timing_phase(void)
+{
+   return phase_current;
+}
+
+
+void
+timing_mark(char *phase)
+{
+   int now = get_ms();
+
+   if (phase_count == 0 && !phase_open) {
+      timing_base = now;
+   }
+
+   if (phase_open) {
+      phases[phase_count - 1].len = now - phases[phase_count - 1].start;
+      phase_open = false;
+   }
+
+   phase_current = phase == NULL ? "other" : phase;
+
+   /*
+    * Retries past the end of the table aren't interesting
+    * enough to track.
+    */
+   if (phase == NULL || phase_count == TIMING_PHASES) {
+      return;
+   }
+
+   phases[phase_count].name = phase;
+   phases[phase_count].start = now;
+   phases[phase_count].len = 0;
+   phase_count++;
+   phase_open = true;
+}
+
+
+void
+timing_print(void)
+{
+   unsigned i;
+   int total = 0;
+
+   for (i = 0; i < phase_count; i++) {
+      printk("%s: %u ms, at %u ms%s\n", phases[i].name,
+             phases[i].len, phases[i].start - timing_base,
+             (phase_open && i == phase_count - 1) ? " (so far)" : "");
+      total += phases[i].len;
+   }
+
+   printk("Total: %u ms\n", total);
+}
+
+
+/*
+ * /chosen/iquik,boot-phases is the list of phase names and
+ * /chosen/iquik,boot-times holds a (start, length) pair of
+ * 32-bit ms values for each, with start relative to the
+ * first phase.
+ */
+void
+timing_export(void)
+{
+   unsigned i;
+   length_t names_len = 0;
+   uint32_t *times;
+   char *names;
+   char *p;
+
+   if (phase_count == 0) {
+      return;
+   }
+
+   for (i = 0; i < phase_count; i++) {
+      names_len += strlen(phases[i].name) + 1;
+   }
+
+   /*
+    * Never freed, as setprop may be shallow.
+    */
+   times = malloc(phase_count * 2 * sizeof(uint32_t));
+   names = malloc(names_len);
+   if (times == NULL || names == NULL) {
+      return;
+   }
+
+   p = names;
+   for (i = 0; i < phase_count; i++) {
+      times[i * 2] = phases[i].start - timing_base;
+      times[i * 2 + 1] = phases[i].len;
+      strcpy(p, phases[i].name);
+      p += strlen(p) + 1;
+   }
+
+   call_prom("setprop", 4, 1, prom_chosen, "iquik,boot-times",
+             times, phase_count * 2 * sizeof(uint32_t));
+   call_prom("setprop", 4, 1, prom_chosen, "iquik,boot-phases",
+             names, names_len);
+}
+
+
+#ifndef CONFIG_TINY
+static quik_err_t
+cmd_timing(char *args)
+{
+   timing_print();
+   return ERR_NONE;
+}
+
+COMMAND(timing, cmd_timing, "show boot phase timing");
+#endif /* CONFIG_TINY */
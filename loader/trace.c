@@ -0,0 +1,302 @@
+/*
+ * OF client interface tracing.
+ *
+ * When on, every call_prom() is recorded with its arguments,
+ * results and timing. Reads also get a digest of the data read,
+ * so that util/ofreplay can check a disk image matches the disk
+ * the trace came from. The trace is printed by !trace, one call
+ * per line, either to the console or to any OF device that can
+ * be written to, such as a serial port.
+ *
+ * Not built with CONFIG_TINY.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "quik.h"
+#include "prom.h"
+#include "trace.h"
+#include "commands.h"
+
+/* Copied string argument, like a device path or property name. */
+#define TRACE_STR 48
+
+/* Bigger than any call_prom() nargs + nret. */
+#define TRACE_ARGS 10
+
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME  16777619U
+
+typedef struct {
+   char *service;
+   uint8_t nargs;
+   uint8_t nret;
+   uint32_t start;
+   uint32_t ticks;
+   uint32_t digest;
+   void *args[TRACE_ARGS];
+   char str[TRACE_STR];
+} trace_rec_t;
+
+bool trace_on;
+static trace_rec_t *trace_recs;
+static unsigned trace_max;
+static unsigned trace_count;
+static unsigned trace_dropped;
+static unsigned trace_skipped;
+
+/*
+ * Services with a string argument worth keeping, and
+ * which argument it is.
+ */
+static struct {
+   char *service;
+   unsigned arg;
+} trace_strings[] = {
+   { "open", 0 },
+   { "finddevice", 0 },
+   { "interpret", 0 },
+   { "call-method", 0 },
+   { "getprop", 1 },
+   { "getproplen", 1 },
+   { "nextprop", 1 },
+   { "setprop", 1 },
+};
+
+
+/*
+ * FNV-1a, which util/ofreplay.c computes the same way.
+ */
+static uint32_t
+trace_digest(unsigned char *buf,
+             length_t len)
+{
+   uint32_t h = FNV_OFFSET;
+
+   while (len--) {
+      h = (h ^ *buf++) * FNV_PRIME;
+   }
+
+   return h;
+}
+
+
+quik_err_t
+trace_start(unsigned records)
+{
+   trace_on = false;
+   free(trace_recs);
+
+   trace_recs = malloc(records * sizeof(trace_rec_t));
+   if (trace_recs == NULL) {
+      trace_max = 0;
+      return ERR_NO_MEM;
+   }
+
+   trace_max = records;
+   trace_count = 0;
+   trace_dropped = 0;
+   trace_skipped = 0;
+   trace_on = true;
+   return ERR_NONE;
+}
+
+
+void
+trace_log(struct prom_args *args,
+          uint32_t start,
+          uint32_t ticks)
+{
+   unsigned i;
+   unsigned n;
+   trace_rec_t *r;
+   length_t len;
+
+   /*
+    * Polling the keyboard and the clock, as the prompt does in a
+    * tight loop, would soon fill the trace and crowd out the disk
+    * I/O that's worth replaying.
+    */
+   if (!strcmp(args->service, "milliseconds") ||
+       (!strcmp(args->service, "read") &&
+        args->args[0] == (void *) prom_stdin)) {
+      trace_skipped++;
+      return;
+   }
+
+   if (trace_count == trace_max) {
+      trace_dropped++;
+      return;
+   }
+
+   r = &trace_recs[trace_count++];
+   r->service = args->service;
+   r->nargs = args->nargs;
+   r->nret = args->nret;
+   r->start = start;
+   r->ticks = ticks;
+   r->digest = 0;
+   r->str[0] = '\0';
+
+   n = MIN(args->nargs + args->nret, TRACE_ARGS);
+   for (i = 0; i < n; i++) {
+      r->args[i] = args->args[i];
+   }
+
+   for (i = 0; i < sizeof(trace_strings) / sizeof(trace_strings[0]); i++) {
+      if (args->nargs > trace_strings[i].arg &&
+          !strcmp(args->service, trace_strings[i].service)) {
+         strncpy(r->str, args->args[trace_strings[i].arg], TRACE_STR - 1);
+         r->str[TRACE_STR - 1] = '\0';
+         break;
+      }
+   }
+
+   if (!strcmp(args->service, "read") && args->nret != 0) {
+      len = (length_t) args->args[args->nargs];
+      if ((int) len > 0) {
+         r->digest = trace_digest(args->args[1], len);
+      }
+   }
+}
+
+
+/*
+ * One line per call:
+ *
+ * C seq service start-us length-us a=args r=results [d=digest] [s=string]
+ *
+ * All numbers but seq and the times are hex. The string is
+ * last, as it runs to the end of the line.
+ */
+static void
+trace_print(void)
+{
+   unsigned i;
+   unsigned j;
+   trace_rec_t *r;
+
+   printk("# iquik OF trace, %u calls, %u dropped, "
+          "%u console and clock polls skipped\n",
+          trace_count, trace_dropped, trace_skipped);
+   for (i = 0; i < trace_count; i++) {
+      r = &trace_recs[i];
+      printk("C %u %s %u %u a=", i, r->service,
+             prom_ticks_to_us(r->start - trace_recs[0].start),
+             prom_ticks_to_us(r->ticks));
+
+      for (j = 0; j < r->nargs + r->nret && j < TRACE_ARGS; j++) {
+         if (j == r->nargs) {
+            printk(" r=");
+         } else if (j != 0) {
+            printk(",");
+         }
+
+         printk("%x", r->args[j]);
+      }
+
+      if (r->nret == 0) {
+         printk(" r=");
+      }
+
+      if (r->digest != 0) {
+         printk(" d=%x", r->digest);
+      }
+
+      if (r->str[0] != '\0') {
+         printk(" s=%s", r->str);
+      }
+
+      printk("\n");
+   }
+}
+
+
+/*
+ * Print the trace to an OF device, by pointing the
+ * console output at it for a while.
+ */
+static quik_err_t
+trace_write(char *device)
+{
+   ihandle dev;
+   ihandle old;
+   bool quiet;
+   quik_err_t err;
+
+   err = prom_open(device, &dev);
+   if (err != ERR_NONE) {
+      return err;
+   }
+
+   prom_flush();
+   old = prom_stdout;
+   quiet = prom_set_quiet(false);
+   prom_stdout = dev;
+
+   trace_print();
+
+   prom_flush();
+   prom_stdout = old;
+   prom_set_quiet(quiet);
+   call_prom("close", 1, 0, dev);
+   return ERR_NONE;
+}
+
+
+static quik_err_t
+cmd_trace(char *args)
+{
+   char *word;
+   char *rest;
+   bool was_on = trace_on;
+   quik_err_t err = ERR_NONE;
+   unsigned records = TRACE_DEFAULT_RECORDS;
+
+   word = args;
+   word_split(&word, &rest);
+   if (word != NULL && !strcmp(word, "on")) {
+      if (*rest != '\0') {
+         records = strtol(rest, NULL, 0);
+         if (records == 0) {
+            return ERR_CMD_BAD_PARAM;
+         }
+      }
+
+      return trace_start(records);
+   } else if (word != NULL && !strcmp(word, "off")) {
+      trace_on = false;
+      return ERR_NONE;
+   }
+
+   /*
+    * Don't trace printing the trace.
+    */
+   trace_on = false;
+   if (word == NULL) {
+      trace_print();
+   } else if (!strcmp(word, "write") && *rest != '\0') {
+      err = trace_write(rest);
+   } else {
+      err = ERR_CMD_BAD_PARAM;
+   }
+
+   trace_on = was_on;
+   return err;
+}
+
+COMMAND(trace, cmd_trace, "OF call trace: on [records], off, write <device>, or show");
@@ -0,0 +1,37 @@
+/*
+ * OF client interface tracing.
+ *
+ * Copyright (C) 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef QUIK_TRACE_H
+#define QUIK_TRACE_H
+
+#include "quik.h"
+#include "prom.h"
+
+/* Records kept by default. */
+#define TRACE_DEFAULT_RECORDS 4096
+
+extern bool trace_on;
+
+quik_err_t trace_start(unsigned records);
+void trace_log(struct prom_args *args,
+               uint32_t start,
+               uint32_t ticks);
+
+#endif /* QUIK_TRACE_H */
@@ -21,6 +21,9 @@
 
 #include "quik.h"
 #include "prom.h"
+#include "task.h"
+
+#define SPINNER_MS 100
 
 char *
 chomp(char *s)
@@ -86,6 +89,19 @@ tolower(int c)
 }
 
 
+#ifdef CONFIG_HEAP_STATS
+#undef strdup
+void *
+strdup_site(char *str, char *file, unsigned line)
+{
+   char *p = malloc_site(strlen(str) + 1, file, line);
+
+   strcpy(p, str);
+   return p;
+}
+#endif /* CONFIG_HEAP_STATS */
+
+
 void *
 strdup(char *str)
 {
@@ -96,6 +112,20 @@ strdup(char *str)
 }
 
 
+#ifdef CONFIG_HOST
+uint16_t
+swab16(uint16_t value)
+{
+   return __builtin_bswap16(value);
+}
+
+
+uint32_t
+swab32(uint32_t value)
+{
+   return __builtin_bswap32(value);
+}
+#else
 uint16_t
 swab16(uint16_t value)
 {
@@ -120,6 +150,7 @@ swab32(uint32_t value)
            : "r" (value), "0" (value >> 24));
    return result;
 }
+#endif /* CONFIG_HOST */
 
 
 int
@@ -160,17 +191,22 @@ strstr(const char * s1,
 }
 
 
+/*
+ * Turns every SPINNER_MS however often it is called.
+ */
 void
-spinner(int freq)
+spinner(void)
 {
    static int i = 0;
+   static uint32_t last;
    static char rot[] = "\\|/-";
+   uint32_t now = prom_ms();
 
-   if (!(i % freq)) {
-      printk ("%c\b", rot[(i / freq) % 4]);
+   if (now - last >= SPINNER_MS) {
+      last = now;
+      printk ("%c\b", rot[i++ % 4]);
+      prom_flush();
    }
-
-   i++;
 }
 
 
@@ -314,6 +350,7 @@ wait_for_key(int timeout,
    if (timeout > 0) {
      end = beg + 100 * timeout;
      do {
+        task_idle();
         c = nbgetchar();
      } while (c == KEY_NONE && get_ms() <= end);
    }
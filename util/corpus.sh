@@ -0,0 +1,336 @@
+#!/bin/bash
+#
+# File system layout benchmark corpus for the loader.
+#
+#   corpus.sh build DIR
+#   corpus.sh run DIR [iquik-host options]
+#
+# 'build' makes Mac-partitioned disk images in DIR, one per file
+# system type (ext2, ext3, ext4 without extents) and block size
+# (1K, 2K, 4K), each holding the same set of layouts:
+#
+#   /boot/vmlinux      contiguous 2MB kernel
+#   /boot/frag         2MB kernel in single-block fragments
+#   /boot/sparse       2MB kernel with a 1MB hole
+#   /boot/big          6MB kernel, needs double-indirect blocks
+#   /boot/link1        chain of six symlinks, the last one slow,
+#                      ending at /boot/vmlinux
+#   /flat/vmlinux      small kernel after 2000 other entries
+#   /deep/d1/.../d32/vmlinux  small kernel 32 levels down
+#
+# Times, UUIDs and hash seeds are fixed, so every build lays the
+# file systems out the same way. 'run' loads each of these with
+# host/iquik-host and prints the device reads, seeks, bytes and
+# modelled time for each, net of what starting up costs. Keep the
+# output of a run as the baseline and diff later runs against it to
+# see what a change to ext2fs.c did.
+#
+# Runs use iquik-host's 'scsi' disk model unless the options given
+# include another -m, as its default 'ideal' model makes seeks free
+# and so hides what layout costs.
+#
+# Needs mke2fs and debugfs from e2fsprogs 1.43 or later.
+#
+# Copyright 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+#
+
+set -e
+
+HOST=${HOST:-$(dirname "$0")/../host/iquik-host}
+UUID=2c1f8f06-4c7b-4a19-9d47-6b1bb0b0f4a5
+FS_MB=40
+MAP_BLOCKS=64
+DEPTH=32
+FLAT=2000
+LINKS=6
+
+FSTYPES="ext2 ext3 ext4"
+BLOCKSIZES="1024 2048 4096"
+
+CASES="contig:/boot/vmlinux frag:/boot/frag sparse:/boot/sparse
+       big:/boot/big link:/boot/link1 flat:/flat/vmlinux
+       deep:/deep$(for i in $(seq 1 $DEPTH); do printf /d$i; done)/vmlinux
+       ls-flat:/flat"
+
+export E2FSPROGS_FAKE_TIME=1356998400
+
+usage()
+{
+   echo "usage: $0 build DIR | run DIR [iquik-host options]" >&2
+   exit 1
+}
+
+be16()
+{
+   printf "$(printf '\\%03o\\%03o' $((($1 >> 8) & 255)) $(($1 & 255)))"
+}
+
+be32()
+{
+   be16 $((($1 >> 16) & 65535))
+   be16 $(($1 & 65535))
+}
+
+#
+# pad FILE SIZE - extend FILE with zeroes to SIZE bytes.
+#
+pad()
+{
+   truncate -s $2 "$1"
+}
+
+#
+# Non-zero filler, as mke2fs -d turns all-zero blocks into holes.
+#
+fill()
+{
+   yes iquik | head -c $1
+}
+
+#
+# mkelf FILE BYTES - a PowerPC kernel image with BYTES of text.
+#
+mkelf()
+{
+   {
+      printf '\177ELF\001\002\001\000\000\000\000\000\000\000\000\000'
+      be16 2; be16 20; be32 1
+      be32 0xc0000000; be32 52; be32 0; be32 0
+      be16 52; be16 32; be16 1; be16 40; be16 0; be16 0
+      be32 1; be32 0x10000; be32 0xc0000000; be32 0
+      be32 $2; be32 $2; be32 5; be32 0x10000
+   } > "$1"
+   pad "$1" 65536
+   fill $2 >> "$1"
+}
+
+#
+# stage DIR BLOCKSIZE - the tree mke2fs -d populates the file
+# system from. The fragmented kernel is added later with debugfs.
+#
+stage()
+{
+   local dir=$1
+   local bs=$2
+   local d
+   local i
+
+   rm -rf "$dir"
+   mkdir -p "$dir/boot" "$dir/flat" "$dir/fill"
+
+   mkelf "$dir/boot/vmlinux" 2097152
+   mkelf "$dir/boot/big" 6291456
+
+   mkelf "$dir/boot/sparse" 2097152
+   dd if=/dev/zero of="$dir/boot/sparse" bs=65536 seek=9 count=16 \
+      conv=notrunc,sparse status=none
+
+   #
+   # link1 -> link2 -> ... -> link6 -> /boot/vmlinux, with link6
+   # too long to fit in the inode (a slow symlink).
+   #
+   for i in $(seq 1 $((LINKS - 1))); do
+      ln -s link$((i + 1)) "$dir/boot/link$i"
+   done
+   ln -s "/boot$(for i in $(seq 1 30); do printf /.; done)/vmlinux" \
+      "$dir/boot/link$LINKS"
+
+   for i in $(seq 1 $FLAT); do
+      : > "$dir/flat/System.map-2.6.$i"
+   done
+   mkelf "$dir/flat/vmlinux" 65536
+
+   d="$dir/deep"
+   for i in $(seq 1 $DEPTH); do
+      d="$d/d$i"
+   done
+   mkdir -p "$d"
+   mkelf "$d/vmlinux" 65536
+
+   #
+   # Enough one-block files to leave a hole for every block of
+   # the fragmented kernel once every other one is removed.
+   #
+   for i in $(seq 1 $((2 * (2097152 + 65536) / bs + 64))); do
+      fill $bs > "$dir/fill/$i"
+   done
+}
+
+#
+# mkfs IMAGE STAGE TYPE BLOCKSIZE
+#
+mkfs()
+{
+   local img=$1
+   local dir=$2
+   local type=$3
+   local bs=$4
+   local opts=
+   local i
+
+   #
+   # The loader does not know about extents or 64-bit group
+   # descriptors.
+   #
+   if [ $type = ext4 ]; then
+      opts="-O ^extent,^64bit"
+   fi
+
+   rm -f "$img"
+   mke2fs -q -F -t $type -b $bs -N 16384 $opts -U $UUID \
+      -E hash_seed=$UUID -d "$dir" "$img" ${FS_MB}M > /dev/null
+
+   mkelf "$dir.frag" 2097152
+   {
+      for i in $(ls "$dir/fill" | sort -n); do
+         if [ $((i % 2)) = 0 ]; then
+            echo "rm /fill/$i"
+         fi
+      done
+      echo "cd /boot"
+      echo "write $dir.frag frag"
+   } > "$dir.cmds"
+   debugfs -w -f "$dir.cmds" "$img" > /dev/null 2>&1
+   rm -f "$dir.frag" "$dir.cmds"
+}
+
+#
+# mkdisk DISK FSIMAGE - put FSIMAGE in partition 2 of a
+# Mac partitioned disk.
+#
+mkdisk()
+{
+   local disk=$1
+   local blocks=$(($(stat -c %s "$2") / 512))
+   local total=$((MAP_BLOCKS + blocks))
+
+   {
+      be16 0x4552; be16 512; be32 $total
+   } > "$disk"
+   pad "$disk" 512
+   mkentry 1 $((MAP_BLOCKS - 1)) Apple Apple_partition_map >> "$disk"
+   mkentry $MAP_BLOCKS $blocks Linux Apple_UNIX_SVR2 >> "$disk"
+   pad "$disk" $((MAP_BLOCKS * 512))
+   cat "$2" >> "$disk"
+}
+
+#
+# mkentry START COUNT NAME TYPE - one 512 byte partition map entry.
+#
+mkentry()
+{
+   local e=$(mktemp)
+
+   {
+      be16 0x504d; be16 0; be32 2; be32 $1; be32 $2
+      printf '%s' $3; head -c $((32 - ${#3})) /dev/zero
+      printf '%s' $4; head -c $((32 - ${#4})) /dev/zero
+      be32 0; be32 $2; be32 0x37
+   } > $e
+   pad $e 512
+   cat $e
+   rm -f $e
+}
+
+build()
+{
+   local out=$1
+   local type
+   local bs
+
+   mkdir -p "$out"
+   for bs in $BLOCKSIZES; do
+      stage "$out/stage" $bs
+      for type in $FSTYPES; do
+         echo "$type-$bs"
+         mkfs "$out/fs.img" "$out/stage" $type $bs
+         mkdisk "$out/$type-$bs.img" "$out/fs.img"
+         rm -f "$out/fs.img"
+      done
+   done
+   rm -rf "$out/stage"
+}
+
+#
+# measure IMAGE [COMMAND] [iquik-host options] - prints
+# "reads seeks bytes us" for one iquik-host run, or
+# nothing if the command failed. Seeks are modelled as
+# on SCSI disks unless the options say otherwise.
+#
+measure()
+{
+   local img=$1
+   local cmd=$2
+   local media=scsi
+   local out
+   local a
+
+   shift 2
+   for a in "$@"; do
+      case "$a" in
+      -m*) media=;;
+      esac
+   done
+
+   out=$("$HOST" ${media:+-m $media} "$@" -d hd="$img" -a hd:2 \
+         ${cmd:+"$cmd"} 2>&1) || return 0
+   case "$cmd" in
+   "!load "*)
+      echo "$out" | grep -q 'Kernel:' || return 0
+      ;;
+   "!ls "*)
+      echo "$out" | grep -q 'Listing' || return 0
+      ;;
+   esac
+
+   echo "$out" | sed -n 's/.*ofemu: [0-9]* calls, \([0-9]*\) reads, \([0-9]*\) seeks, \([0-9]*\) bytes, \([0-9]*\) us.*/\1 \2 \3 \4/p'
+}
+
+run()
+{
+   local dir=$1
+   local img
+   local c
+   local name
+   local base
+   local res
+
+   shift
+   [ -x "$HOST" ] || { echo "$HOST not built, try 'make host'" >&2; exit 1; }
+
+   printf "%-10s %-8s %8s %8s %10s %10s\n" image case reads seeks bytes us
+   for img in "$dir"/*.img; do
+      base=$(measure "$img" "" "$@")
+      for c in $CASES; do
+         name=${c%%:*}
+         case $name in
+         ls-*) res=$(measure "$img" "!ls ${c#*:}" "$@");;
+         *) res=$(measure "$img" "!load ${c#*:}" "$@");;
+         esac
+
+         if [ -z "$res" ]; then
+            printf "%-10s %-8s FAILED\n" $(basename "$img" .img) $name
+            continue
+         fi
+
+         echo $base $res | awk -v i=$(basename "$img" .img) -v c=$name \
+            '{ printf "%-10s %-8s %8d %8d %10d %10d\n", i, c,
+                  $5 - $1, $6 - $2, $7 - $3, $8 - $4 }'
+      done
+   done
+}
+
+case "$1" in
+build)
+   [ $# = 2 ] || usage
+   build "$2"
+   ;;
+run)
+   [ $# -ge 2 ] || usage
+   shift
+   run "$@"
+   ;;
+*)
+   usage
+   ;;
+esac
@@ -0,0 +1,331 @@
+/*
+ * Replay the disk reads in an iQUIK OF trace against a disk image.
+ *
+ * The trace comes from '!trace' in the loader. Every seek and read
+ * is redone against the image, and each read is checked against the
+ * digest recorded on the real machine. The report gives the I/O
+ * counts, the time the firmware actually took, and the time a
+ * simple disk model estimates. Comparing the reports for traces
+ * from two loader versions shows what a change did to disk I/O,
+ * without needing the hardware.
+ *
+ * All devices opened in the trace are taken to be the image, which
+ * must be of the whole disk, as the loader reads the partition map
+ * itself and seeks by absolute offset.
+ *
+ * Copyright 2013 Andrei Warkentin <andrey.warkentin@gmail.com>
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define MAX_ARGS 10
+#define MAX_HANDLES 16
+#define MAX_SERVICES 64
+
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME  16777619U
+
+typedef struct {
+   uint32_t ih;
+   uint64_t pos;
+   uint64_t next;
+} handle_t;
+
+typedef struct {
+   char name[32];
+   unsigned calls;
+   uint64_t us;
+} service_t;
+
+/* Disk model, see usage(). */
+unsigned call_us = 150;
+unsigned seek_us = 12000;
+unsigned kbps = 4000;
+
+handle_t handles[MAX_HANDLES];
+unsigned nhandles;
+service_t services[MAX_SERVICES];
+unsigned nservices;
+
+unsigned reads, seeks, short_reads, bad_digests;
+uint64_t bytes, io_us, est_us;
+
+
+void
+usage(char *name)
+{
+   fprintf(stderr,
+           "Usage: %s [-c call-us] [-s seek-us] [-b KB/s] image [trace]\n"
+           "  -c  cost of one OF client interface call (%u us)\n"
+           "  -s  cost of a non-sequential read (%u us)\n"
+           "  -b  media transfer rate (%u KB/s)\n",
+           name, call_us, seek_us, kbps);
+   exit(1);
+}
+
+
+uint32_t
+digest(unsigned char *buf,
+       size_t len)
+{
+   uint32_t h = FNV_OFFSET;
+
+   while (len--) {
+      h = (h ^ *buf++) * FNV_PRIME;
+   }
+
+   return h;
+}
+
+
+handle_t *
+handle(uint32_t ih,
+       int create)
+{
+   unsigned i;
+
+   for (i = 0; i < nhandles; i++) {
+      if (handles[i].ih == ih) {
+         return &handles[i];
+      }
+   }
+
+   if (!create || nhandles == MAX_HANDLES) {
+      return NULL;
+   }
+
+   handles[nhandles].ih = ih;
+   handles[nhandles].pos = 0;
+   handles[nhandles].next = 0;
+   return &handles[nhandles++];
+}
+
+
+void
+account(char *name,
+        unsigned us)
+{
+   unsigned i;
+
+   for (i = 0; i < nservices; i++) {
+      if (!strcmp(services[i].name, name)) {
+         break;
+      }
+   }
+
+   if (i == nservices) {
+      if (nservices == MAX_SERVICES) {
+         return;
+      }
+
+      strncpy(services[i].name, name, sizeof(services[i].name) - 1);
+      nservices++;
+   }
+
+   services[i].calls++;
+   services[i].us += us;
+}
+
+
+/*
+ * Parse a comma-separated list of hex values.
+ */
+unsigned
+values(char *s,
+       uint32_t *v)
+{
+   unsigned n = 0;
+
+   while (*s != '\0' && *s != ' ' && *s != '\n' && n < MAX_ARGS) {
+      v[n++] = strtoul(s, &s, 16);
+      if (*s == ',') {
+         s++;
+      }
+   }
+
+   return n;
+}
+
+
+void
+replay_read(int fd,
+            uint32_t *a,
+            uint32_t *r,
+            char *d,
+            unsigned us,
+            unsigned long seq)
+{
+   handle_t *h;
+   ssize_t got;
+   uint32_t len = a[2];
+   uint32_t count = r[0];
+   static unsigned char *buf;
+   static uint32_t buf_len;
+
+   h = handle(a[0], 0);
+   if (h == NULL) {
+      return;
+   }
+
+   if (len > buf_len) {
+      buf = realloc(buf, len);
+      if (buf == NULL) {
+         perror("realloc");
+         exit(1);
+      }
+
+      buf_len = len;
+   }
+
+   reads++;
+   io_us += us;
+   est_us += 2 * call_us + (uint64_t) len * 1000000 / (kbps * 1024ULL);
+   if (h->pos != h->next) {
+      seeks++;
+      est_us += seek_us;
+   }
+
+   got = pread(fd, buf, len, h->pos);
+   if (got < 0) {
+      got = 0;
+   }
+
+   if ((uint32_t) got != count) {
+      short_reads++;
+      fprintf(stderr, "C %lu: read %u at 0x%" PRIx64 " got %zd, trace had %u\n",
+              seq, len, h->pos, got, count);
+   } else if (d != NULL && (int32_t) count > 0 &&
+              digest(buf, got) != strtoul(d + 2, NULL, 16)) {
+      bad_digests++;
+      fprintf(stderr, "C %lu: data at 0x%" PRIx64 " differs from the trace\n",
+              seq, h->pos);
+   }
+
+   if ((int32_t) count > 0) {
+      bytes += count;
+      h->pos += count;
+   }
+
+   h->next = h->pos;
+}
+
+
+int
+main(int ac, char **av)
+{
+   int c;
+   int fd;
+   FILE *fi = stdin;
+   char line[1024];
+   char service[32];
+   unsigned long seq;
+   unsigned start, us;
+   unsigned na, nr;
+   uint32_t a[MAX_ARGS], r[MAX_ARGS];
+   char *p, *d, *s;
+   handle_t *h;
+   uint64_t total_us = 0;
+   unsigned i;
+
+   while ((c = getopt(ac, av, "c:s:b:")) != -1) {
+      switch (c) {
+      case 'c':
+         call_us = strtoul(optarg, NULL, 0);
+         break;
+      case 's':
+         seek_us = strtoul(optarg, NULL, 0);
+         break;
+      case 'b':
+         kbps = strtoul(optarg, NULL, 0);
+         break;
+      default:
+         usage(av[0]);
+      }
+   }
+
+   if (optind == ac || ac - optind > 2 || kbps == 0) {
+      usage(av[0]);
+   }
+
+   fd = open(av[optind], O_RDONLY);
+   if (fd < 0) {
+      perror(av[optind]);
+      exit(1);
+   }
+
+   if (ac - optind == 2) {
+      fi = fopen(av[optind + 1], "r");
+      if (fi == NULL) {
+         perror(av[optind + 1]);
+         exit(1);
+      }
+   }
+
+   while (fgets(line, sizeof(line), fi) != NULL) {
+
+      /*
+       * Console captures have \r\n line ends.
+       */
+      p = strchr(line, '\r');
+      if (p != NULL) {
+         *p = '\0';
+      }
+
+      if (sscanf(line, "C %lu %31s %u %u", &seq, service,
+                 &start, &us) != 4) {
+         continue;
+      }
+
+      p = strstr(line, " a=");
+      if (p == NULL) {
+         continue;
+      }
+
+      na = values(p + 3, a);
+      p = strstr(p, " r=");
+      nr = p == NULL ? 0 : values(p + 3, r);
+      d = strstr(line, " d=");
+      s = strstr(line, " s=");
+      if (d != NULL) {
+         d++;
+      }
+
+      account(service, us);
+      total_us += us;
+
+      if (!strcmp(service, "open") && nr >= 1 && r[0] != 0) {
+         handle(r[0], 1);
+         if (s != NULL) {
+            printf("open %s -> %x\n", s + 3, r[0]);
+         }
+      } else if (!strcmp(service, "seek") && na >= 3) {
+         h = handle(a[0], 0);
+         if (h != NULL) {
+            h->pos = ((uint64_t) a[1] << 32) | a[2];
+            io_us += us;
+         }
+      } else if (!strcmp(service, "read") && na >= 3 && nr >= 1) {
+         replay_read(fd, a, r, d, us, seq);
+      }
+   }
+
+   printf("\n%u reads, %" PRIu64 " bytes, %u non-sequential, "
+          "%u short, %u bad data\n",
+          reads, bytes, seeks, short_reads, bad_digests);
+   printf("seek+read: %" PRIu64 " us recorded, %" PRIu64 " us estimated\n",
+          io_us, est_us);
+   printf("all OF calls: %" PRIu64 " us recorded\n\n", total_us);
+   for (i = 0; i < nservices; i++) {
+      printf("%-20s %8u calls %12" PRIu64 " us\n", services[i].name,
+             services[i].calls, services[i].us);
+   }
+
+   return short_reads != 0 || bad_digests != 0;
+}